@@ -33,7 +33,13 @@
 #include <stdbool.h>
 #include <string.h>
 #include <float.h>
+#include <math.h>
+#include <locale.h>
+#include <time.h>
 #include "umsgpack.h"
+#include "umsgpack_json.h"
+#include "umsgpack_log.h"
+#include "umsgpack_parallel.h"
 #include "minunit/minunit.h"
 
 #define FORMAT_MAX_SIZE 9
@@ -64,6 +70,8 @@ static void judge_system_endian(void) {
 	m_is_bigendian = (*(uint8_t*)&v);
 }
 
+static void generate_pattern(char *dst, size_t len);
+
 static inline uint16_t _be16(uint16_t v) {
 	if (m_is_bigendian) return v;
 	const uint8_t *b = (const uint8_t*)&v;
@@ -223,26 +231,301 @@ MU_TEST(test_true) {
 
 MU_TEST(test_bin8) {
 	/* 0xc4 + uint8-length + data... */
+	const size_t max_data_size = 0xff;
+	const size_t data_size = FORMAT_MAX_SIZE + max_data_size;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	const uint8_t format = 0xc4;
+	const uint8_t bin_lengths[] = { 0x00, 0x01, 0x20, 0xff };
+	const int numof_testdata = sizeof(bin_lengths) / sizeof(bin_lengths[0]);
+
+	char ptn[0xff];
+	generate_pattern(ptn, max_data_size);
+
+	for (int i = 0; i < numof_testdata; i++) {
+		uint8_t len = bin_lengths[i];
+		mu_check( umsgpack_pack_bin(m_pack, ptn, len) );
+		// length
+		mu_assert_int_eq(1+sizeof(uint8_t)+len, m_pack->pos);
+		// format
+		mu_assert_int_eq(format, m_pack->data[0]);
+		mu_assert_int_eq(len, m_pack->data[1]);
+		// data
+		mu_check(!memcmp(ptn, &m_pack->data[2], len));
+		m_pack->pos = 0;
+	}
+
+	/* header only */
+	mu_check( umsgpack_pack_bin(m_pack, NULL, 0x10) );
+	mu_assert_int_eq(2, m_pack->pos);
+	m_pack->pos = 0;
+	mu_check( !umsgpack_pack_bin(m_pack, ptn, data_size) );
 }
 
 MU_TEST(test_bin16) {
-	/* 0xc5 + uint16-length + data... */
+	/* 0xc5 + uint16-length[BigEndian] + data... */
+	const size_t max_data_size = 0xffff;
+	const size_t data_size = FORMAT_MAX_SIZE + max_data_size;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	const uint8_t format = 0xc5;
+	const uint16_t bin_lengths[] = { 0x0100, 0xffff };
+	const int numof_testdata = sizeof(bin_lengths) / sizeof(bin_lengths[0]);
+
+	char *ptn = malloc(max_data_size);
+	if (!ptn) {
+		fprintf(stderr, "%s: failed malloc(%lu). skip test.\n", __func__, max_data_size);
+		return;
+	}
+	generate_pattern(ptn, max_data_size);
+
+	for (int i = 0; i < numof_testdata; i++) {
+		uint16_t len = bin_lengths[i];
+		const uint16_t *act_len;
+		mu_check( umsgpack_pack_bin(m_pack, ptn, len) );
+		// length
+		mu_assert_int_eq(1+sizeof(uint16_t)+len, m_pack->pos);
+		// format
+		mu_assert_int_eq(format, m_pack->data[0]);
+		act_len = (const uint16_t*)&m_pack->data[1];
+		mu_assert_int_eq((uint16_t)len, (uint16_t)_be16(*act_len));
+		// data
+		mu_check(!memcmp(ptn, &m_pack->data[3], len));
+		m_pack->pos = 0;
+	}
+
+	free(ptn);
 }
 
 MU_TEST(test_bin32) {
-	/* 0xc6 + uint32-length + data... */
+	/* 0xc6 + uint32-length[BigEndian] + data... */
+	const size_t max_data_size = 0x10000;
+	const size_t data_size = FORMAT_MAX_SIZE + max_data_size;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	const uint8_t format = 0xc6;
+	const uint32_t len = 0x10000;
+	const uint32_t *act_len;
+
+	char *ptn = malloc(max_data_size);
+	if (!ptn) {
+		fprintf(stderr, "%s: failed malloc(%lu). skip test.\n", __func__, max_data_size);
+		return;
+	}
+	generate_pattern(ptn, max_data_size);
+
+	mu_check( umsgpack_pack_bin(m_pack, ptn, len) );
+	// length
+	mu_assert_int_eq(1+sizeof(uint32_t)+len, m_pack->pos);
+	// format
+	mu_assert_int_eq(format, m_pack->data[0]);
+	act_len = (const uint32_t*)&m_pack->data[1];
+	mu_assert_int_eq(len, _be32(*act_len));
+	// data
+	mu_check(!memcmp(ptn, &m_pack->data[5], len));
+	m_pack->pos = 0;
+
+	/* the header plus payload size must not wrap */
+	mu_check( !umsgpack_pack_bin(m_pack, NULL, 0xffffffff) );
+
+	free(ptn);
 }
 
 MU_TEST(test_ext8) {
 	/* 0xc7 + uint8-length + 8bit-type + data... */
+	const size_t max_data_size = 0xff;
+	const size_t data_size = FORMAT_MAX_SIZE + max_data_size;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	/* fixext: 1, 2, 4, 8, 16 */
+	const uint8_t format = 0xc7;
+	const uint8_t ext_lengths[] = { 0x00, 0x03, 0x11, 0xff };
+	const int numof_testdata = sizeof(ext_lengths) / sizeof(ext_lengths[0]);
+
+	char ptn[0xff];
+	generate_pattern(ptn, max_data_size);
+
+	for (int i = 0; i < numof_testdata; i++) {
+		uint8_t len = ext_lengths[i];
+		mu_check( umsgpack_pack_ext(m_pack, 0x7f, ptn, len) );
+		// length
+		mu_assert_int_eq(1+sizeof(uint8_t)+1+len, m_pack->pos);
+		// format
+		mu_assert_int_eq(format, m_pack->data[0]);
+		mu_assert_int_eq(len, m_pack->data[1]);
+		mu_assert_int_eq(0x7f, m_pack->data[2]);
+		// data
+		mu_check(!memcmp(ptn, &m_pack->data[3], len));
+		m_pack->pos = 0;
+	}
+
+	/* negative (reserved) type codes pass through */
+	mu_check( umsgpack_pack_ext(m_pack, -2, ptn, 3) );
+	mu_assert_int_eq(0xfe, m_pack->data[2]);
 }
 
 MU_TEST(test_ext16) {
-	/* 0xc8 + uint16-length + 8bit-type + data... */
+	/* 0xc8 + uint16-length[BigEndian] + 8bit-type + data... */
+	const size_t max_data_size = 0xffff;
+	const size_t data_size = FORMAT_MAX_SIZE + max_data_size;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	const uint8_t format = 0xc8;
+	const uint16_t ext_lengths[] = { 0x0100, 0xffff };
+	const int numof_testdata = sizeof(ext_lengths) / sizeof(ext_lengths[0]);
+
+	char *ptn = malloc(max_data_size);
+	if (!ptn) {
+		fprintf(stderr, "%s: failed malloc(%lu). skip test.\n", __func__, max_data_size);
+		return;
+	}
+	generate_pattern(ptn, max_data_size);
+
+	for (int i = 0; i < numof_testdata; i++) {
+		uint16_t len = ext_lengths[i];
+		const uint16_t *act_len;
+		mu_check( umsgpack_pack_ext(m_pack, 1, ptn, len) );
+		// length
+		mu_assert_int_eq(1+sizeof(uint16_t)+1+len, m_pack->pos);
+		// format
+		mu_assert_int_eq(format, m_pack->data[0]);
+		act_len = (const uint16_t*)&m_pack->data[1];
+		mu_assert_int_eq((uint16_t)len, (uint16_t)_be16(*act_len));
+		mu_assert_int_eq(1, m_pack->data[3]);
+		// data
+		mu_check(!memcmp(ptn, &m_pack->data[4], len));
+		m_pack->pos = 0;
+	}
+
+	free(ptn);
 }
 
 MU_TEST(test_ext32) {
-	/* 0xc9 + uint32-length + 8bit-type + data... */
+	/* 0xc9 + uint32-length[BigEndian] + 8bit-type + data... */
+	const size_t max_data_size = 0x10000;
+	const size_t data_size = FORMAT_MAX_SIZE + max_data_size;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	const uint8_t format = 0xc9;
+	const uint32_t len = 0x10000;
+	const uint32_t *act_len;
+
+	char *ptn = malloc(max_data_size);
+	if (!ptn) {
+		fprintf(stderr, "%s: failed malloc(%lu). skip test.\n", __func__, max_data_size);
+		return;
+	}
+	generate_pattern(ptn, max_data_size);
+
+	mu_check( umsgpack_pack_ext(m_pack, 2, ptn, len) );
+	// length
+	mu_assert_int_eq(1+sizeof(uint32_t)+1+len, m_pack->pos);
+	// format
+	mu_assert_int_eq(format, m_pack->data[0]);
+	act_len = (const uint32_t*)&m_pack->data[1];
+	mu_assert_int_eq(len, _be32(*act_len));
+	mu_assert_int_eq(2, m_pack->data[5]);
+	// data
+	mu_check(!memcmp(ptn, &m_pack->data[6], len));
+
+	free(ptn);
+}
+
+MU_TEST(test_timestamp) {
+	const size_t data_size = 64;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	/* timestamp 32: 0xd6 0xff + uint32 seconds */
+	mu_check( umsgpack_pack_timestamp(m_pack, 0x5f5e1000, 0) );
+	{
+		const unsigned char expects[] = { 0xd6, 0xff, 0x5f, 0x5e, 0x10, 0x00 };
+		mu_assert_int_eq(sizeof(expects), m_pack->pos);
+		mu_check(!memcmp(expects, m_pack->data, sizeof(expects)));
+	}
+	m_pack->pos = 0;
+
+	/* timestamp 64: 0xd7 0xff + 30-bit nsec + 34-bit seconds */
+	mu_check( umsgpack_pack_timestamp(m_pack, 0xffffffff, 999999999) );
+	{
+		const unsigned char expects[] = { 0xd7, 0xff, 0xee, 0x6b, 0x27, 0xfc, 0xff, 0xff, 0xff, 0xff };
+		mu_assert_int_eq(sizeof(expects), m_pack->pos);
+		mu_check(!memcmp(expects, m_pack->data, sizeof(expects)));
+	}
+	m_pack->pos = 0;
+	mu_check( !umsgpack_pack_timestamp(m_pack, 0, 1000000000) );
+	mu_assert_int_eq(0, m_pack->pos);
+
+#ifdef UMSGPACK_FUNC_INT64
+	mu_check( umsgpack_pack_timestamp64(m_pack, 1, 0) );
+	mu_assert_int_eq(6, m_pack->pos);
+	mu_check( umsgpack_pack_timestamp64(m_pack, 0x3ffffffffLL, 1) );
+	mu_assert_int_eq(6 + 10, m_pack->pos);
+	mu_assert_int_eq(0x07, m_pack->data[6 + 5]);
+	/* timestamp 96: 0xc7 12 0xff + uint32 nsec + int64 seconds */
+	mu_check( umsgpack_pack_timestamp64(m_pack, -1, 500) );
+	{
+		const unsigned char expects[] = { 0xc7, 0x0c, 0xff, 0x00, 0x00, 0x01, 0xf4,
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+		mu_assert_int_eq(6 + 10 + sizeof(expects), m_pack->pos);
+		mu_check(!memcmp(expects, &m_pack->data[16], sizeof(expects)));
+	}
+	mu_check( umsgpack_pack_timestamp64(m_pack, 0x400000000LL, 0) );
+	mu_assert_int_eq(0xc7, m_pack->data[31]);
+#endif
+
+#ifdef UMSGPACK_FUNC_UNPACK
+	{
+		const int64_t secs[] = { 1, 0x3ffffffffLL, -1, 0x400000000LL };
+		const uint32_t nsecs[] = { 0, 1, 500, 0 };
+		struct umsgpack_obj obj;
+		size_t off = 0, n;
+		int64_t sec;
+		uint32_t nsec;
+
+		for (int i = 0; i < 4; i++) {
+			n = umsgpack_unpack_next(m_pack->data + off, m_pack->pos - off, &obj);
+			mu_check(n > 0);
+			mu_check( umsgpack_unpack_timestamp(&obj, &sec, &nsec) );
+			mu_check(sec == secs[i]);
+			mu_assert_int_eq(nsecs[i], nsec);
+			off += n;
+		}
+		mu_assert_int_eq(m_pack->pos, off);
+
+		m_pack->pos = 0;
+		mu_check( umsgpack_pack_ext(m_pack, 1, "abcd", 4) );
+		mu_check( umsgpack_unpack_next(m_pack->data, m_pack->pos, &obj) );
+		mu_check( !umsgpack_unpack_timestamp(&obj, &sec, &nsec) );
+	}
+#endif
 }
 
 MU_TEST(test_float32) {
@@ -276,6 +559,164 @@ MU_TEST(test_float32) {
 
 MU_TEST(test_float64) {
 	/* 0xcb + float64-value[BigEndian,IEEE754] */
+	const size_t unit_size = sizeof(double);
+	const size_t data_size = FORMAT_MAX_SIZE + unit_size;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	const uint8_t foramt = 0xcb;
+	const double testdata[] = { DBL_MIN, 0.0, 0.1, -1.5, DBL_MAX };
+	const int numof_testdata = sizeof(testdata) / sizeof(testdata[0]);
+
+	for (int i = 0; i < numof_testdata; i++) {
+		double expects = testdata[i], actual;
+		uint64_t bits = 0;
+		mu_check( umsgpack_pack_double(m_pack, expects) );
+		// length
+		mu_assert_int_eq(1+unit_size, m_pack->pos);
+		// format
+		mu_assert_int_eq(foramt, m_pack->data[0]);
+		// value
+		for (int j = 1; j <= 8; j++)
+			bits = bits << 8 | m_pack->data[j];
+		memcpy(&actual, &bits, sizeof(actual));
+		mu_assert_double_eq(expects, actual);
+		m_pack->pos = 0;
+	}
+	m_pack->length = 8;
+	mu_check( !umsgpack_pack_double(m_pack, 1.0) );
+}
+
+#if defined(UMSGPACK_TEST_MCF) && defined(UMSGPACK_FUNC_UNPACK)
+MU_TEST(test_mcf) {
+	/* Microchip float: eeeeeeee s mmmmmmm mmmmmmmm mmmmmmmm */
+	static const struct { uint32_t ieee, mcf; } both[] = {
+		{ 0x00000000, 0x00000000 },    /* +-0 */
+		{ 0x80000000, 0x00800000 },
+		{ 0x3f800000, 0x7f000000 },    /* +-1.0 */
+		{ 0xbf800000, 0x7f800000 },
+		{ 0x40490fdb, 0x80490fdb },    /* pi */
+		{ 0x00800000, 0x01000000 },    /* FLT_MIN, lowest exponent */
+		{ 0x80800000, 0x01800000 },
+		{ 0x7f7fffff, 0xfe7fffff },    /* FLT_MAX, highest exponent */
+		{ 0xff7fffff, 0xfeffffff },
+	};
+	static const struct { uint32_t from, to; } to_mcf[] = {
+		{ 0x00000001, 0x00000000 },    /* subnormals flush to zero */
+		{ 0x807fffff, 0x00800000 },
+		{ 0x7f800000, 0xff7fffff },    /* +-Inf saturate */
+		{ 0xff800000, 0xffffffff },
+		{ 0x7fc00000, 0xff7fffff },    /* NaN too */
+	};
+	static const struct { uint32_t from, to; } to_ieee[] = {
+		{ 0x00123456, 0x00000000 },    /* zero with mantissa bits */
+		{ 0x00fedcba, 0x80000000 },
+		{ 0xff000000, 0x7f800000 },    /* top binade: +-Inf */
+		{ 0xff812345, 0xff800000 },
+	};
+
+	for (size_t i = 0; i < sizeof(both) / sizeof(both[0]); i++) {
+		mu_assert_int_eq(both[i].mcf, umsgpack_test_ieee_to_mcf(both[i].ieee));
+		mu_assert_int_eq(both[i].ieee, umsgpack_test_mcf_to_ieee(both[i].mcf));
+	}
+	for (size_t i = 0; i < sizeof(to_mcf) / sizeof(to_mcf[0]); i++)
+		mu_assert_int_eq(to_mcf[i].to, umsgpack_test_ieee_to_mcf(to_mcf[i].from));
+	for (size_t i = 0; i < sizeof(to_ieee) / sizeof(to_ieee[0]); i++)
+		mu_assert_int_eq(to_ieee[i].to, umsgpack_test_mcf_to_ieee(to_ieee[i].from));
+
+	/* every normal exponent and sign, a spread of mantissas */
+	for (uint32_t exp = 1; exp < 0xff; exp++) {
+		for (uint32_t mant = 0; mant < 0x800000; mant += 0x10001) {
+			uint32_t ieee = exp << 23 | mant, mcf = exp << 24 | mant;
+			mu_check( umsgpack_test_ieee_to_mcf(ieee) == mcf );
+			mu_check( umsgpack_test_ieee_to_mcf(ieee | 0x80000000) == (mcf | 0x800000) );
+			mu_check( umsgpack_test_mcf_to_ieee(mcf) == ieee );
+			mu_check( umsgpack_test_mcf_to_ieee(mcf | 0x800000) == (ieee | 0x80000000) );
+		}
+	}
+}
+#endif
+
+MU_TEST(test_double_compact) {
+	static const struct {
+		double value;
+		unsigned char encoded[9];
+		unsigned size;
+	} cases[] = {
+		{ 0.0, { 0x00 }, 1 },
+		{ 42.0, { 0x2a }, 1 },
+		{ -1.0, { 0xff }, 1 },
+		{ 300.0, { 0xcd, 0x01, 0x2c }, 3 },
+		{ -2147483648.0, { 0xd2, 0x80, 0x00, 0x00, 0x00 }, 5 },
+		{ -2147483649.0, { 0xd3, 0xff, 0xff, 0xff, 0xff, 0x7f, 0xff, 0xff, 0xff }, 9 },
+		{ 18446744073709549568.0, { 0xcf, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf8, 0x00 }, 9 },
+		{ 1.5, { 0xca, 0x3f, 0xc0, 0x00, 0x00 }, 5 },
+		{ -0.0, { 0xca, 0x80, 0x00, 0x00, 0x00 }, 5 },
+		{ 1e-45, { 0xcb, 0x36, 0x96, 0xd6, 0x01, 0xad, 0x37, 0x6a, 0xb9 }, 9 },
+		{ 1.401298464324817e-45, { 0xca, 0x00, 0x00, 0x00, 0x01 }, 5 },
+		{ 18446744073709551616.0, { 0xca, 0x5f, 0x80, 0x00, 0x00 }, 5 },
+		{ 0.1, { 0xcb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a }, 9 },
+		{ HUGE_VAL, { 0xca, 0x7f, 0x80, 0x00, 0x00 }, 5 },
+	};
+
+	m_pack = umsgpack_alloc(16);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(16). skip test.\n", __func__);
+		return;
+	}
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		m_pack->pos = 0;
+		mu_check( umsgpack_pack_double_compact(m_pack, cases[i].value) );
+		mu_assert_int_eq(cases[i].size, m_pack->pos);
+		mu_check( !memcmp(m_pack->data, cases[i].encoded, cases[i].size) );
+	}
+
+	/* narrow keeps integral values as floats and never casts 1e300 to float */
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_double_narrow(m_pack, 42.0) );
+	mu_check( umsgpack_pack_double_narrow(m_pack, 1e300) );
+	{
+		const unsigned char expects[] = {
+			0xca, 0x42, 0x28, 0x00, 0x00,
+			0xcb, 0x7e, 0x37, 0xe4, 0x3c, 0x88, 0x00, 0x75, 0x9c,
+		};
+		mu_assert_int_eq(sizeof(expects), m_pack->pos);
+		mu_check( !memcmp(m_pack->data, expects, sizeof(expects)) );
+	}
+}
+
+MU_TEST(test_fixed_as_float) {
+	static const struct {
+		int32_t raw;
+		int frac_bits;
+	} cases[] = {
+		{ 0, 8 }, { 0x0100, 8 }, { -0x0180, 8 }, { 0x1733, 8 }, { 1, 31 },
+		{ INT32_MAX, 0 }, { INT32_MIN, 0 }, { INT32_MIN, 31 }, { 0x7fffffc0, 16 },
+		{ 0x01000001, 0 }, { 0x01000003, 0 }, { -0x0123456, 16 },
+	};
+
+	m_pack = umsgpack_alloc(16);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(16). skip test.\n", __func__);
+		return;
+	}
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		float expects = (float)ldexp(cases[i].raw, -cases[i].frac_bits);
+		uint32_t bits;
+
+		memcpy(&bits, &expects, sizeof(bits));
+		m_pack->pos = 0;
+		mu_check( umsgpack_pack_fixed_as_float(m_pack, cases[i].raw, cases[i].frac_bits) );
+		mu_assert_int_eq(5, m_pack->pos);
+		mu_assert_int_eq(0xca, m_pack->data[0]);
+		mu_assert_int_eq(bits, (uint32_t)m_pack->data[1] << 24 | m_pack->data[2] << 16 |
+				   m_pack->data[3] << 8 | m_pack->data[4]);
+	}
+	mu_check( !umsgpack_pack_fixed_as_float(m_pack, 1, 32) );
+	mu_check( !umsgpack_pack_fixed_as_float(m_pack, 1, -1) );
 }
 
 MU_TEST(test_uint8) {
@@ -531,24 +972,55 @@ MU_TEST(test_int64) {
 	}
 }
 
+static void test_fixext(uint8_t format, uint32_t len) {
+	const size_t data_size = FORMAT_MAX_SIZE + 16;
+	char ptn[16];
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+	generate_pattern(ptn, sizeof(ptn));
+
+	mu_check( umsgpack_pack_ext(m_pack, 0x05, ptn, len) );
+	// length
+	mu_assert_int_eq(1+1+len, m_pack->pos);
+	// format
+	mu_assert_int_eq(format, m_pack->data[0]);
+	mu_assert_int_eq(0x05, m_pack->data[1]);
+	// data
+	mu_check(!memcmp(ptn, &m_pack->data[2], len));
+	m_pack->pos = 0;
+
+	/* header only */
+	mu_check( umsgpack_pack_ext(m_pack, -1, NULL, len) );
+	mu_assert_int_eq(2, m_pack->pos);
+	mu_assert_int_eq(0xff, m_pack->data[1]);
+}
+
 MU_TEST(test_fixext1) {
 	/* 0xd4 + 8bit-type + 8bit-data */
+	test_fixext(0xd4, 1);
 }
 
 MU_TEST(test_fixext2) {
 	/* 0xd5 + 8bit-type + 16bit-data */
+	test_fixext(0xd5, 2);
 }
 
 MU_TEST(test_fixext4) {
 	/* 0xd6 + 8bit-type + 32bit-data */
+	test_fixext(0xd6, 4);
 }
 
 MU_TEST(test_fixext8) {
 	/* 0xd7 + 8bit-type + 64bit-data */
+	test_fixext(0xd7, 8);
 }
 
 MU_TEST(test_fixext16) {
 	/* 0xd8 + 8bit-type + 128bit-data */
+	test_fixext(0xd8, 16);
 }
 
 static void generate_pattern(char *dst, size_t len) {
@@ -645,6 +1117,53 @@ MU_TEST(test_str32) {
 	/* 0xdb + uint32-lenght[BigEndian] + string... */
 }
 
+MU_TEST(test_reserve) {
+	const size_t data_size = 0x200;
+	unsigned char *p;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	p = umsgpack_reserve_str(m_pack, 5);
+	mu_check(p == &m_pack->data[1]);
+	mu_assert_int_eq(6, m_pack->pos);
+	memcpy(p, "degC=", 5);
+	p = umsgpack_reserve_str(m_pack, 40);
+	mu_check(p == &m_pack->data[8]);
+	mu_assert_int_eq(48, m_pack->pos);
+	mu_assert_int_eq(0xd9, m_pack->data[6]);
+	mu_assert_int_eq(40, m_pack->data[7]);
+
+	p = umsgpack_reserve_bin(m_pack, 3);
+	mu_check(p == &m_pack->data[50]);
+	mu_assert_int_eq(0xc4, m_pack->data[48]);
+	mu_assert_int_eq(3, m_pack->data[49]);
+	p = umsgpack_reserve_bin(m_pack, 0x100);
+	mu_check(p == &m_pack->data[56]);
+	mu_assert_int_eq(0xc5, m_pack->data[53]);
+	mu_assert_int_eq(0x01, m_pack->data[54]);
+	mu_assert_int_eq(0x00, m_pack->data[55]);
+	mu_assert_int_eq(56 + 0x100, m_pack->pos);
+	mu_check( umsgpack_pack_nil(m_pack) );
+	mu_assert_int_eq(0xc0, m_pack->data[56 + 0x100]);
+
+	/* too large: nothing written */
+	mu_check(umsgpack_reserve_bin(m_pack, 0x200) == NULL);
+	mu_check(umsgpack_reserve_str(m_pack, 0x200) == NULL);
+	mu_assert_int_eq(57 + 0x100, m_pack->pos);
+
+#ifdef UMSGPACK_FUNC_UNPACK
+	{
+		struct umsgpack_obj obj;
+		mu_assert_int_eq(6, umsgpack_unpack_next(m_pack->data, m_pack->pos, &obj));
+		mu_check(obj.type == UMSGPACK_TYPE_STR && !memcmp(obj.ptr, "degC=", 5));
+		mu_check( umsgpack_validate(m_pack->data, m_pack->pos) );
+	}
+#endif
+}
+
 MU_TEST(test_array16) {
 	/* 0xdc + uint16-length[BigEndian] + {N objects} */
 	const size_t data_size = FORMAT_MAX_SIZE;
@@ -675,6 +1194,29 @@ MU_TEST(test_array16) {
 
 MU_TEST(test_array32) {
 	/* 0xdd + uint32-lenght[BigEndian] + {N objects} */
+	const size_t data_size = FORMAT_MAX_SIZE;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	const uint8_t format = 0xdd;
+	const uint32_t data_lengths[] = { 0x00010000, 0x00123456, 0x7fffffff };
+	const int numof_testdata = sizeof(data_lengths) / sizeof(data_lengths[0]);
+
+	for (int i = 0; i < numof_testdata; i++) {
+		uint32_t len = data_lengths[i];
+		const uint32_t *act_len;
+		mu_check( umsgpack_pack_array(m_pack, (int)len) );
+		// length
+		mu_assert_int_eq(1+sizeof(uint32_t), m_pack->pos);
+		// format
+		mu_assert_int_eq(format, m_pack->data[0]);
+		act_len = (const uint32_t*)&m_pack->data[1];
+		mu_assert_int_eq(len, _be32(*act_len));
+		m_pack->pos = 0;
+	}
 }
 
 MU_TEST(test_map16) {
@@ -753,6 +1295,1668 @@ MU_TEST(test_negative_fixint) {
 	}
 }
 
+#ifdef UMSGPACK_FUNC_UNPACK
+MU_TEST(test_unpack_next) {
+	const size_t data_size = 64;
+	struct umsgpack_obj obj;
+	size_t off = 0, n;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	mu_check( umsgpack_pack_map(m_pack, 0x10) );
+	mu_check( umsgpack_pack_str(m_pack, "degC", 4) );
+	mu_check( umsgpack_pack_int(m_pack, -200) );
+	mu_check( umsgpack_pack_uint64(m_pack, 0x100000000) );
+	mu_check( umsgpack_pack_float(m_pack, 23.5F) );
+	mu_check( umsgpack_pack_bool(m_pack, 1) );
+
+	n = umsgpack_unpack_next(m_pack->data, m_pack->pos, &obj);
+	mu_assert_int_eq(3, n);
+	mu_assert_int_eq(UMSGPACK_TYPE_MAP, obj.type);
+	mu_assert_int_eq(0x10, obj.length);
+	off += n;
+	n = umsgpack_unpack_next(m_pack->data + off, m_pack->pos - off, &obj);
+	mu_assert_int_eq(5, n);
+	mu_assert_int_eq(UMSGPACK_TYPE_STR, obj.type);
+	mu_check(obj.length == 4 && !memcmp(obj.ptr, "degC", 4));
+	off += n;
+	n = umsgpack_unpack_next(m_pack->data + off, m_pack->pos - off, &obj);
+	mu_assert_int_eq(3, n);
+	mu_assert_int_eq(UMSGPACK_TYPE_INT, obj.type);
+	mu_assert_int_eq(-200, obj.v.i);
+	off += n;
+	n = umsgpack_unpack_next(m_pack->data + off, m_pack->pos - off, &obj);
+	mu_assert_int_eq(9, n);
+	mu_assert_int_eq(UMSGPACK_TYPE_UINT, obj.type);
+	mu_check(obj.v.u == 0x100000000);
+	off += n;
+	n = umsgpack_unpack_next(m_pack->data + off, m_pack->pos - off, &obj);
+	mu_assert_int_eq(5, n);
+	mu_assert_int_eq(UMSGPACK_TYPE_FLOAT32, obj.type);
+	mu_assert_double_eq(23.5, obj.v.f);
+	off += n;
+	n = umsgpack_unpack_next(m_pack->data + off, m_pack->pos - off, &obj);
+	mu_assert_int_eq(1, n);
+	mu_assert_int_eq(UMSGPACK_TYPE_BOOL, obj.type);
+	mu_assert_int_eq(1, obj.v.u);
+	off += n;
+	mu_assert_int_eq(m_pack->pos, off);
+
+	/* truncated and reserved */
+	mu_assert_int_eq(0, umsgpack_unpack_next(m_pack->data + 3, 4, &obj));
+	mu_assert_int_eq(0, umsgpack_unpack_next((const unsigned char *)"\xc1", 1, &obj));
+	mu_assert_int_eq(0, umsgpack_unpack_next(m_pack->data, 0, &obj));
+}
+
+MU_TEST(test_skip) {
+	const size_t data_size = 300;
+	size_t len;
+	char ptn[256];
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	generate_pattern(ptn, sizeof(ptn));
+	mu_check( umsgpack_pack_map(m_pack, 0x10) );
+	for (int i = 0; i < 0x10; i++) {
+		mu_check( umsgpack_pack_uint(m_pack, i) );
+		if (i == 3) {
+			mu_check( umsgpack_pack_array(m_pack, 2) );
+			mu_check( umsgpack_pack_str(m_pack, ptn, 200) );
+			mu_check( umsgpack_pack_map(m_pack, 0) );
+		} else {
+			mu_check( umsgpack_pack_int(m_pack, -1000 * i) );
+		}
+	}
+	len = m_pack->pos;
+	mu_check( umsgpack_pack_nil(m_pack) );
+
+	mu_assert_int_eq(len, umsgpack_skip(m_pack->data, m_pack->pos));
+	mu_check( umsgpack_validate(m_pack->data, m_pack->pos) );
+	for (size_t i = 0; i < len; i++) {
+		mu_assert_int_eq(0, umsgpack_skip(m_pack->data, i));
+		mu_check( !umsgpack_validate(m_pack->data, i) );
+	}
+	mu_assert_int_eq(1, umsgpack_skip(m_pack->data + len, 1));
+
+	{
+		const unsigned char huge[] = { 0xdd, 0xff, 0xff, 0xff, 0xff, 0xc0 };
+		const unsigned char unused[] = { 0x92, 0x01, 0xc1 };
+		const unsigned char fixext16[] = { 0xd8, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+		mu_assert_int_eq(0, umsgpack_skip(huge, sizeof(huge)));
+		mu_assert_int_eq(0, umsgpack_skip(unused, sizeof(unused)));
+		mu_assert_int_eq(sizeof(fixext16), umsgpack_skip(fixext16, sizeof(fixext16)));
+	}
+}
+
+MU_TEST(test_map_find) {
+	const size_t data_size = 400;
+	const char *path[] = { "sensor", "degC" };
+	const char *missing[] = { "sensor", "rh" };
+	const char *scalar[] = { "id", "degC" };
+	const unsigned char *v;
+	size_t vlen;
+	char ptn[256];
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	/* {0: nil, "blob": str8, "id": 0x1234, "sensor": {"deg": 1, "degC": -5}, "degC": 7} */
+	generate_pattern(ptn, sizeof(ptn));
+	mu_check( umsgpack_pack_map(m_pack, 5) );
+	mu_check( umsgpack_pack_uint(m_pack, 0) );
+	mu_check( umsgpack_pack_nil(m_pack) );
+	mu_check( umsgpack_pack_str(m_pack, "blob", 4) );
+	mu_check( umsgpack_pack_str(m_pack, ptn, 200) );
+	mu_check( umsgpack_pack_str(m_pack, "id", 2) );
+	mu_check( umsgpack_pack_uint(m_pack, 0x1234) );
+	mu_check( umsgpack_pack_str(m_pack, "sensor", 6) );
+	mu_check( umsgpack_pack_map(m_pack, 2) );
+	mu_check( umsgpack_pack_str(m_pack, "deg", 3) );
+	mu_check( umsgpack_pack_uint(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "degC", 4) );
+	mu_check( umsgpack_pack_int(m_pack, -5) );
+	mu_check( umsgpack_pack_str(m_pack, "degC", 4) );
+	mu_check( umsgpack_pack_uint(m_pack, 7) );
+
+	v = umsgpack_map_find(m_pack->data, m_pack->pos, "id", 2, &vlen);
+	mu_check(v != NULL);
+	mu_assert_int_eq(3, vlen);
+	mu_assert_int_eq(0xcd, v[0]);
+	v = umsgpack_map_find(m_pack->data, m_pack->pos, "blob", 4, &vlen);
+	mu_check(v != NULL);
+	mu_assert_int_eq(202, vlen);
+	v = umsgpack_map_find(m_pack->data, m_pack->pos, "degC", 4, &vlen);
+	mu_check(v != NULL && vlen == 1 && v[0] == 0x07);
+	mu_check(umsgpack_map_find(m_pack->data, m_pack->pos, "de", 2, NULL) == NULL);
+	mu_check(umsgpack_map_find(m_pack->data, m_pack->pos, "sensorX", 7, NULL) == NULL);
+
+	v = umsgpack_map_path(m_pack->data, m_pack->pos, path, 2, &vlen);
+	mu_check(v != NULL && vlen == 1 && v[0] == 0xfb);
+	mu_check(umsgpack_map_path(m_pack->data, m_pack->pos, missing, 2, NULL) == NULL);
+	mu_check(umsgpack_map_path(m_pack->data, m_pack->pos, scalar, 2, NULL) == NULL);
+	v = umsgpack_map_path(m_pack->data, m_pack->pos, path, 0, &vlen);
+	mu_check(v == m_pack->data && vlen == m_pack->pos);
+
+	/* not a map, truncated before the key */
+	mu_check(umsgpack_map_find(m_pack->data + 1, m_pack->pos - 1, "id", 2, NULL) == NULL);
+	mu_check(umsgpack_map_find(m_pack->data, 100, "id", 2, NULL) == NULL);
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_JSON
+static size_t to_json(const unsigned char *p, size_t len, char *json, size_t size) {
+	struct umsgpack_json_out out = { .buf = json, .size = size - 1 };
+	size_t n = umsgpack_to_json(p, len, &out);
+	json[out.pos] = '\0';
+	return n;
+}
+
+MU_TEST(test_to_json) {
+	const size_t data_size = 128;
+	char json[128];
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	mu_check( umsgpack_pack_map(m_pack, 4) );
+	mu_check( umsgpack_pack_str(m_pack, "degC", 4) );
+	mu_check( umsgpack_pack_float(m_pack, 23.4F) );
+	mu_check( umsgpack_pack_str(m_pack, "id", 2) );
+	mu_check( umsgpack_pack_int64(m_pack, INT64_MIN) );
+	mu_check( umsgpack_pack_int(m_pack, 7) );
+	mu_check( umsgpack_pack_array(m_pack, 4) );
+	mu_check( umsgpack_pack_nil(m_pack) );
+	mu_check( umsgpack_pack_bool(m_pack, 0) );
+	mu_check( umsgpack_pack_map(m_pack, 0) );
+	mu_check( umsgpack_pack_str(m_pack, "a\"b\\c\n\x01", 7) );
+	mu_check( umsgpack_pack_str(m_pack, "nested", 6) );
+	mu_check( umsgpack_pack_array(m_pack, 1) );
+	mu_check( umsgpack_pack_array(m_pack, 1) );
+	mu_check( umsgpack_pack_uint64(m_pack, UINT64_MAX) );
+
+	mu_assert_int_eq(m_pack->pos, to_json(m_pack->data, m_pack->pos, json, sizeof(json)));
+	mu_assert_string_eq("{\"degC\":23.4,\"id\":-9223372036854775808,"
+		"\"7\":[null,false,{},\"a\\\"b\\\\c\\n\\u0001\"],"
+		"\"nested\":[[18446744073709551615]]}", json);
+
+	/* bin8 and fixext1 */
+	{
+		const unsigned char bin[] = { 0x92, 0xc4, 0x04, 'a', 'b', 'c', 'd', 0xd4, 0x05, 0xff };
+		mu_assert_int_eq(sizeof(bin), to_json(bin, sizeof(bin), json, sizeof(json)));
+		mu_assert_string_eq("[\"YWJjZA==\",[5,\"/w==\"]]", json);
+	}
+
+	/* a bin key is one quoted string; an ext key has no JSON form */
+	{
+		const unsigned char bin_key[] = { 0x81, 0xc4, 0x01, 0x00, 0x01 };
+		const unsigned char ext_key[] = { 0x81, 0xd4, 0x01, 0x00, 0x01 };
+		mu_assert_int_eq(sizeof(bin_key), to_json(bin_key, sizeof(bin_key), json, sizeof(json)));
+		mu_assert_string_eq("{\"AA==\":1}", json);
+		mu_assert_int_eq(0, to_json(ext_key, sizeof(ext_key), json, sizeof(json)));
+	}
+
+	/* truncated input and output */
+	mu_assert_int_eq(0, to_json(m_pack->data, m_pack->pos - 1, json, sizeof(json)));
+	mu_assert_int_eq(0, to_json(m_pack->data, m_pack->pos, json, 16));
+}
+
+struct json_sink {
+	char text[256];
+	size_t len;
+	int calls;
+};
+
+static int json_sink_flush(void *ctx, const char *data, size_t len) {
+	struct json_sink *sink = ctx;
+	if (sink->len + len >= sizeof(sink->text))
+		return 0;
+	memcpy(sink->text + sink->len, data, len);
+	sink->len += len;
+	sink->text[sink->len] = '\0';
+	sink->calls++;
+	return 1;
+}
+
+MU_TEST(test_to_json_sink) {
+	const size_t data_size = 128;
+	char window[8];
+	struct json_sink sink = { "", 0, 0 };
+	struct umsgpack_json_out out = {
+		.buf = window, .size = sizeof(window), .flush = json_sink_flush, .ctx = &sink,
+	};
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	mu_check( umsgpack_pack_array(m_pack, 3) );
+	mu_check( umsgpack_pack_str(m_pack, "humidity, percent", 17) );
+	mu_check( umsgpack_pack_int(m_pack, -12345) );
+	mu_check( umsgpack_pack_float(m_pack, 51.2F) );
+
+	mu_assert_int_eq(m_pack->pos, umsgpack_to_json(m_pack->data, m_pack->pos, &out));
+	mu_check( umsgpack_json_flush(&out) );
+	mu_check(sink.calls > 1);
+	mu_assert_string_eq("[\"humidity, percent\",-12345,51.2]", sink.text);
+}
+
+
+MU_TEST(test_pack_json) {
+	const size_t data_size = 256;
+	char json[256];
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	{
+		const char doc[] = " {\"degC\": 23.5, \"id\" : -1, \"big\":18446744073709551615,"
+			" \"list\":[true,false,null,[],{}], \"pi\":3.14159, \"s\":\"a\\\"\\u00e9\\ud83d\\ude00\"} ";
+		const unsigned char expects[] = {
+			0x86,
+			0xa4, 'd', 'e', 'g', 'C', 0xca, 0x41, 0xbc, 0x00, 0x00,
+			0xa2, 'i', 'd', 0xff,
+			0xa3, 'b', 'i', 'g', 0xcf, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+			0xa4, 'l', 'i', 's', 't', 0x95, 0xc3, 0xc2, 0xc0, 0x90, 0x80,
+			0xa2, 'p', 'i', 0xcb, 0x40, 0x09, 0x21, 0xf9, 0xf0, 0x1b, 0x86, 0x6e,
+			0xa1, 's', 0xa8, 'a', '"', 0xc3, 0xa9, 0xf0, 0x9f, 0x98, 0x80,
+		};
+		mu_check( umsgpack_pack_json(m_pack, doc, sizeof(doc) - 1) );
+		mu_assert_int_eq(sizeof(expects), m_pack->pos);
+		mu_check(!memcmp(expects, m_pack->data, sizeof(expects)));
+		m_pack->pos = 0;
+	}
+
+	/* more than 15 entries: the header grows and the contents move */
+	{
+		const char doc[] = "[[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16],\"end\"]";
+		mu_check( umsgpack_pack_json(m_pack, doc, sizeof(doc) - 1) );
+		mu_assert_int_eq(1 + 3 + 17 + 4, m_pack->pos);
+		mu_assert_int_eq(0x92, m_pack->data[0]);
+		mu_assert_int_eq(0xdc, m_pack->data[1]);
+		mu_assert_int_eq(17, m_pack->data[3]);
+		mu_assert_int_eq(16, m_pack->data[20]);
+		mu_assert_int_eq(m_pack->pos, to_json(m_pack->data, m_pack->pos, json, sizeof(json)));
+		mu_assert_string_eq(doc, json);
+		m_pack->pos = 0;
+	}
+
+	/* malformed */
+	{
+		const char *bad[] = { "", "{", "[1,]", "{\"a\"}", "{1:2}", "01", "1.", "\"\\x\"", "tru", "[1] x", "\"\\ud800\"",
+			"1e400", "-1e400", "1.7976931348623159e308", "[1e99999]" };
+		for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+			m_pack->pos = 0;
+			mu_check( !umsgpack_pack_json(m_pack, bad[i], strlen(bad[i])) );
+		}
+	}
+}
+
+/*
+ * Locales with a ',' decimal separator; the first one setlocale() knows is
+ * used, UMSGPACK_TEST_LOCALE names another. Returns 0 if none is installed.
+ */
+static int comma_locale(void) {
+	const char *names[] = { getenv("UMSGPACK_TEST_LOCALE"), "de_DE.UTF-8", "de_DE.utf8",
+		"de_DE", "fr_FR.UTF-8", "fr_FR.utf8", "nl_NL.UTF-8", "ru_RU.UTF-8" };
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (names[i] && setlocale(LC_NUMERIC, names[i]) &&
+		    *localeconv()->decimal_point == ',')
+			return 1;
+	}
+	setlocale(LC_NUMERIC, "C");
+	return 0;
+}
+
+static void check_json_numbers(void) {
+	static const struct { double v; int single; const char *text; } cases[] = {
+		{ 23.4F, 1, "23.4" },
+		{ 51.2F, 1, "51.2" },
+		{ 1e7F, 1, "1e+07" },
+		{ 3.14159265F, 1, "3.1415927" },
+		{ FLT_MIN, 1, "1.1754944e-38" },
+		{ 0.1, 0, "0.1" },
+		{ 2.5, 0, "2.5" },
+		{ -0.0, 0, "-0" },
+		{ 123456.0, 0, "123456" },
+		{ 0.0001, 0, "0.0001" },
+		{ 1e-5, 0, "1e-05" },
+		{ 1e15, 0, "1e+15" },
+		{ 1e20, 0, "1e+20" },
+		{ 3.14159, 0, "3.14159" },
+		{ 1.0 / 3, 0, "0.3333333333333333" },
+		{ DBL_MAX, 0, "1.7976931348623157e+308" },
+		{ 5e-324, 0, "5e-324" },
+	};
+	char json[32];
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		m_pack->pos = 0;
+		if (cases[i].single)
+			mu_check( umsgpack_pack_float(m_pack, (float)cases[i].v) );
+		else
+			mu_check( umsgpack_pack_double(m_pack, cases[i].v) );
+		mu_assert_int_eq(m_pack->pos, to_json(m_pack->data, m_pack->pos, json, sizeof(json)));
+		mu_assert_string_eq(cases[i].text, json);
+	}
+}
+
+static void check_pack_json_numbers(void) {
+	/* fast path, out of float range, slow path past 19 digits and 64 characters */
+	const char doc[] = "[23.5,3.14159,1e300,-1e-300,1e-5,0.1,-0.0,2.5e-3,"
+		"1.00000000000000000001,1234567890123456789012345678901,"
+		"0.12345678901234567890123456789012345678901234567890123456789012345678901234567890,"
+		"1.7976931348623158e308]";
+	const unsigned char expects[] = {
+		0x9c,
+		0xca, 0x41, 0xbc, 0x00, 0x00,
+		0xcb, 0x40, 0x09, 0x21, 0xf9, 0xf0, 0x1b, 0x86, 0x6e,
+		0xcb, 0x7e, 0x37, 0xe4, 0x3c, 0x88, 0x00, 0x75, 0x9c,
+		0xcb, 0x81, 0xa5, 0x6e, 0x1f, 0xc2, 0xf8, 0xf3, 0x59,
+		0xcb, 0x3e, 0xe4, 0xf8, 0xb5, 0x88, 0xe3, 0x68, 0xf1,
+		0xcb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a,
+		0xca, 0x80, 0x00, 0x00, 0x00,
+		0xcb, 0x3f, 0x64, 0x7a, 0xe1, 0x47, 0xae, 0x14, 0x7b,
+		0xca, 0x3f, 0x80, 0x00, 0x00,
+		0xcb, 0x46, 0x2f, 0x2a, 0x35, 0x3f, 0x47, 0x45, 0x0e,
+		0xcb, 0x3f, 0xbf, 0x9a, 0xdd, 0x37, 0x46, 0xf6, 0x5f,
+		0xcb, 0x7f, 0xef, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	};
+
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_json(m_pack, doc, sizeof(doc) - 1) );
+	mu_assert_int_eq(sizeof(expects), m_pack->pos);
+	mu_check(!memcmp(expects, m_pack->data, sizeof(expects)));
+}
+
+MU_TEST(test_json_locale) {
+	const size_t data_size = 128;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	check_json_numbers();
+	check_pack_json_numbers();
+
+	/* printf and strtod follow LC_NUMERIC; the JSON text must not */
+	if (!comma_locale()) {
+		fprintf(stderr, "%s: no locale with a ',' decimal point. skip test.\n", __func__);
+		return;
+	}
+	check_json_numbers();
+	check_pack_json_numbers();
+	setlocale(LC_NUMERIC, "C");
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_DICT
+static const char *const m_dict_keys[] = { "degC", "humidity", "id", "battery", "rssi" };
+
+MU_TEST(test_dict) {
+	const size_t data_size = 64;
+	struct umsgpack_dict dict;
+	uint8_t table[10];
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	mu_check( umsgpack_dict_init(&dict, 1, m_dict_keys, 5, table, sizeof(table)) );
+	for (int i = 0; i < 5; i++) {
+		mu_assert_int_eq(i, umsgpack_dict_find(&dict, m_dict_keys[i], strlen(m_dict_keys[i])));
+		mu_assert_string_eq(m_dict_keys[i], umsgpack_dict_name(&dict, i));
+	}
+	mu_assert_int_eq(-1, umsgpack_dict_find(&dict, "deg", 3));
+	mu_assert_int_eq(-1, umsgpack_dict_find(&dict, "degCC", 5));
+	/* wire keys may hold NULs: a key plus NUL padding is not the key */
+	for (int i = 0; i < 5; i++) {
+		char key[24] = { 0 };
+		size_t len = strlen(m_dict_keys[i]);
+		memcpy(key, m_dict_keys[i], len);
+		for (size_t pad = 1; pad <= 8; pad++)
+			mu_assert_int_eq(-1, umsgpack_dict_find(&dict, key, len + pad));
+		key[len + 1] = 'x';
+		mu_assert_int_eq(-1, umsgpack_dict_find(&dict, key, len + 2));
+	}
+	mu_check(umsgpack_dict_name(&dict, 5) == NULL);
+
+	mu_check( umsgpack_pack_map(m_pack, 2) );
+	mu_check( umsgpack_pack_key(m_pack, &dict, "humidity", 8) );
+	mu_check( umsgpack_pack_uint(m_pack, 51) );
+	mu_check( umsgpack_pack_key(m_pack, &dict, "lux", 3) );
+	mu_check( umsgpack_pack_uint(m_pack, 300) );
+	{
+		const unsigned char expects[] = { 0x82, 0x01, 0x33, 0xa3, 'l', 'u', 'x', 0xcd, 0x01, 0x2c };
+		mu_assert_int_eq(sizeof(expects), m_pack->pos);
+		mu_check(!memcmp(expects, m_pack->data, sizeof(expects)));
+	}
+
+#ifdef UMSGPACK_FUNC_JSON
+	{
+		char json[64];
+		struct umsgpack_json_out out = { .buf = json, .size = sizeof(json) - 1, .dict = &dict };
+		mu_assert_int_eq(m_pack->pos, umsgpack_to_json(m_pack->data, m_pack->pos, &out));
+		json[out.pos] = '\0';
+		mu_assert_string_eq("{\"humidity\":51,\"lux\":300}", json);
+	}
+#endif
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_DELTA
+static const struct umsgpack_delta_field m_delta_fields[] = {
+	{ "degC", UMSGPACK_DELTA_FLOAT },
+	{ "humidity", UMSGPACK_DELTA_INT },
+	{ "door", UMSGPACK_DELTA_BOOL },
+};
+
+MU_TEST(test_delta) {
+	const size_t data_size = 64;
+	union umsgpack_delta_value tx_values[3], rx_values[3], rec[3];
+	struct umsgpack_delta tx, rx;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	umsgpack_delta_init(&tx, m_delta_fields, tx_values, 3, 3);
+	memset(rx_values, 0, sizeof(rx_values));
+	umsgpack_delta_init(&rx, m_delta_fields, rx_values, 3, 3);
+
+	/* first record is a keyframe */
+	rec[0].f = 23.5F;
+	rec[1].i = 40;
+	rec[2].i = 0;
+	mu_check( umsgpack_pack_delta(m_pack, &tx, rec) );
+	mu_assert_int_eq(0x83, m_pack->data[0]);
+#ifdef UMSGPACK_FUNC_UNPACK
+	mu_assert_int_eq(m_pack->pos, umsgpack_unpack_delta(&rx, m_pack->data, m_pack->pos));
+	mu_check(rx.valid);
+	mu_check(!memcmp(rec, rx_values, sizeof(rec)));
+#endif
+
+	/* only humidity changed */
+	m_pack->pos = 0;
+	rec[1].i = 41;
+	mu_check( umsgpack_pack_delta(m_pack, &tx, rec) );
+	{
+		const unsigned char expects[] = { 0x81, 0xa8, 'h', 'u', 'm', 'i', 'd', 'i', 't', 'y', 41 };
+		mu_assert_int_eq(sizeof(expects), m_pack->pos);
+		mu_check(!memcmp(expects, m_pack->data, sizeof(expects)));
+	}
+#ifdef UMSGPACK_FUNC_UNPACK
+	mu_assert_int_eq(m_pack->pos, umsgpack_unpack_delta(&rx, m_pack->data, m_pack->pos));
+	mu_check(!memcmp(rec, rx_values, sizeof(rec)));
+#endif
+
+	/* nothing changed */
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_delta(m_pack, &tx, rec) );
+	mu_assert_int_eq(1, m_pack->pos);
+	mu_assert_int_eq(0x80, m_pack->data[0]);
+
+	/* third record after the keyframe carries every field again */
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_delta(m_pack, &tx, rec) );
+	mu_assert_int_eq(0x83, m_pack->data[0]);
+
+	/* a failed pack leaves the state alone */
+	m_pack->pos = m_pack->length - 4;
+	rec[2].i = 1;
+	rec[0].f = 24.0F;
+	mu_check( !umsgpack_pack_delta(m_pack, &tx, rec) );
+	mu_assert_int_eq(m_pack->length - 4, m_pack->pos);
+	mu_check(!tx_values[2].i);
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_delta(m_pack, &tx, rec) );
+	mu_assert_int_eq(0x82, m_pack->data[0]);
+#ifdef UMSGPACK_FUNC_UNPACK
+	mu_assert_int_eq(m_pack->pos, umsgpack_unpack_delta(&rx, m_pack->data, m_pack->pos));
+	mu_check(!memcmp(rec, rx_values, sizeof(rec)));
+
+	/* INT fields take int32 only; keys are matched by length */
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_map(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "humidity", 8) );
+	mu_check( umsgpack_pack_uint32(m_pack, 0x80000000UL) );
+	mu_assert_int_eq(0, umsgpack_unpack_delta(&rx, m_pack->data, m_pack->pos));
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_map(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "humidity", 8) );
+	mu_check( umsgpack_pack_int64(m_pack, -0x80000001LL) );
+	mu_assert_int_eq(0, umsgpack_unpack_delta(&rx, m_pack->data, m_pack->pos));
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_map(m_pack, 2) );
+	mu_check( umsgpack_pack_str(m_pack, "humidity", 8) );
+	mu_check( umsgpack_pack_int32(m_pack, INT32_MIN) );
+	mu_check( umsgpack_pack_str(m_pack, "door\0\0", 6) );
+	mu_check( umsgpack_pack_bool(m_pack, 0) );
+	mu_assert_int_eq(m_pack->pos, umsgpack_unpack_delta(&rx, m_pack->data, m_pack->pos));
+	mu_assert_int_eq(INT32_MIN, rx_values[1].i);
+	mu_assert_int_eq(1, rx_values[2].i);
+#endif
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_LOG
+#define TEST_LOG_PATH "/tmp/umsgpack_test.log"
+#define TEST_LOG_INDEX_PATH "/tmp/umsgpack_test.log.idx"
+
+MU_TEST(test_log) {
+	const size_t data_size = 16;
+	struct umsgpack_log log;
+	const unsigned char *rec;
+	size_t len;
+	uint64_t ts;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	remove(TEST_LOG_PATH);
+	remove(TEST_LOG_INDEX_PATH);
+	mu_check( umsgpack_log_open(&log, TEST_LOG_PATH, TEST_LOG_INDEX_PATH, 64, 8) );
+	for (int i = 0; i < 8; i++) {
+		m_pack->pos = 0;
+		mu_check( umsgpack_pack_array(m_pack, 2) );
+		mu_check( umsgpack_pack_uint(m_pack, i) );
+		mu_check( umsgpack_pack_uint(m_pack, i * 100) );
+		mu_check( umsgpack_log_append(&log, m_pack, 1000 + i * 10) );
+	}
+	/* index full */
+	mu_check( !umsgpack_log_append(&log, m_pack, 2000) );
+	mu_check( umsgpack_log_sync(&log) );
+	umsgpack_log_close(&log);
+
+	mu_check( umsgpack_log_open(&log, TEST_LOG_PATH, TEST_LOG_INDEX_PATH, 64, 8) );
+	mu_assert_int_eq(8, umsgpack_log_count(&log));
+	rec = umsgpack_log_get(&log, 3, &len, &ts);
+	mu_check(rec != NULL);
+	mu_assert_int_eq(1030, ts);
+	mu_assert_int_eq(5, len);
+	{
+		const unsigned char expects[] = { 0x92, 0x03, 0xcd, 0x01, 0x2c };
+		mu_check(!memcmp(expects, rec, sizeof(expects)));
+	}
+	mu_check(umsgpack_log_get(&log, 8, &len, &ts) == NULL);
+
+	mu_assert_int_eq(0, umsgpack_log_find(&log, 0));
+	mu_assert_int_eq(3, umsgpack_log_find(&log, 1030));
+	mu_assert_int_eq(4, umsgpack_log_find(&log, 1031));
+	mu_assert_int_eq(8, umsgpack_log_find(&log, 5000));
+
+	/* a damaged index entry cuts the log back to the records before it */
+	log.entries[5].offset = ~(uint64_t)0;
+	umsgpack_log_close(&log);
+	mu_check( umsgpack_log_open(&log, TEST_LOG_PATH, TEST_LOG_INDEX_PATH, 64, 8) );
+	mu_assert_int_eq(5, umsgpack_log_count(&log));
+	rec = umsgpack_log_get(&log, 4, &len, &ts);
+	mu_check(rec != NULL);
+	mu_check((size_t)(rec - log.data) + len <= 64);
+	mu_check(umsgpack_log_get(&log, 5, &len, &ts) == NULL);
+	log.entries[2].offset = 1;
+	umsgpack_log_close(&log);
+	mu_check( umsgpack_log_open(&log, TEST_LOG_PATH, TEST_LOG_INDEX_PATH, 64, 8) );
+	mu_assert_int_eq(2, umsgpack_log_count(&log));
+	umsgpack_log_close(&log);
+
+	remove(TEST_LOG_PATH);
+	remove(TEST_LOG_INDEX_PATH);
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_PARALLEL
+#define TEST_PARALLEL_RECORDS 1000
+#define TEST_PARALLEL_CHUNK 64
+
+struct test_parallel_ctx {
+	uint64_t sums[(TEST_PARALLEL_RECORDS + TEST_PARALLEL_CHUNK - 1) / TEST_PARALLEL_CHUNK];
+	size_t merged[(TEST_PARALLEL_RECORDS + TEST_PARALLEL_CHUNK - 1) / TEST_PARALLEL_CHUNK];
+	size_t nmerged;
+	uint64_t total;
+};
+
+static int test_parallel_work(void *ctx, size_t chunk, const unsigned char *p, size_t len,
+                              size_t first, size_t records) {
+	struct test_parallel_ctx *c = ctx;
+	struct umsgpack_obj obj;
+	uint64_t sum = 0;
+	size_t n;
+
+	while (len) {
+		/* [index, value] */
+		if (!(n = umsgpack_unpack_next(p, len, &obj)) || obj.type != UMSGPACK_TYPE_ARRAY)
+			return 0;
+		p += n; len -= n;
+		if (!(n = umsgpack_unpack_next(p, len, &obj)) || obj.v.u != first++)
+			return 0;
+		p += n; len -= n;
+		if (!(n = umsgpack_unpack_next(p, len, &obj)))
+			return 0;
+		p += n; len -= n;
+		sum += obj.v.u;
+		records--;
+	}
+	c->sums[chunk] = sum;
+	return records == 0;
+}
+
+static int test_parallel_merge(void *ctx, size_t chunk) {
+	struct test_parallel_ctx *c = ctx;
+	c->merged[c->nmerged++] = chunk;
+	c->total += c->sums[chunk];
+	return 1;
+}
+
+/*
+ * merge() of chunk 0 waits for the work() of the last chunk, and the other
+ * chunks wait for that merge to start: this only finishes if workers can
+ * claim chunks while merge() runs. Gives up after a few seconds.
+ */
+struct test_parallel_block {
+	pthread_mutex_t lock;
+	int merging;
+	int last_started;
+	size_t last;
+};
+
+static int test_parallel_wait(struct test_parallel_block *b, int *flag) {
+	time_t deadline = time(NULL) + 3;
+	int set;
+
+	do {
+		pthread_mutex_lock(&b->lock);
+		set = *flag;
+		pthread_mutex_unlock(&b->lock);
+	} while (!set && time(NULL) < deadline);
+	return set;
+}
+
+static int test_parallel_block_work(void *ctx, size_t chunk, const unsigned char *p, size_t len,
+                                    size_t first, size_t records) {
+	struct test_parallel_block *b = ctx;
+
+	if (chunk == b->last) {
+		pthread_mutex_lock(&b->lock);
+		b->last_started = 1;
+		pthread_mutex_unlock(&b->lock);
+		return 1;
+	}
+	return !chunk || test_parallel_wait(b, &b->merging);
+}
+
+static int test_parallel_block_merge(void *ctx, size_t chunk) {
+	struct test_parallel_block *b = ctx;
+
+	if (chunk)
+		return 1;
+	pthread_mutex_lock(&b->lock);
+	b->merging = 1;
+	pthread_mutex_unlock(&b->lock);
+	return test_parallel_wait(b, &b->last_started);
+}
+
+MU_TEST(test_parallel) {
+	const size_t data_size = TEST_PARALLEL_RECORDS * 9;
+	static size_t offsets[TEST_PARALLEL_RECORDS + 1];
+	static struct test_parallel_ctx ctx;
+	struct umsgpack_parallel_job job;
+	uint64_t expect = 0;
+	size_t end;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	for (uint32_t i = 0; i < TEST_PARALLEL_RECORDS; i++) {
+		mu_check( umsgpack_pack_array(m_pack, 2) );
+		mu_check( umsgpack_pack_uint(m_pack, i) );
+		mu_check( umsgpack_pack_uint32(m_pack, i * 7) );
+		expect += i * 7;
+	}
+	mu_assert_int_eq(TEST_PARALLEL_RECORDS,
+	                 umsgpack_parallel_index(m_pack->data, m_pack->pos, offsets,
+	                                         TEST_PARALLEL_RECORDS + 1, &end));
+	mu_assert_int_eq(m_pack->pos, end);
+	/* truncated tail is left out of the index */
+	mu_assert_int_eq(TEST_PARALLEL_RECORDS - 1,
+	                 umsgpack_parallel_index(m_pack->data, m_pack->pos - 1, offsets,
+	                                         TEST_PARALLEL_RECORDS + 1, &end));
+	mu_assert_int_eq(offsets[TEST_PARALLEL_RECORDS - 1], end);
+	umsgpack_parallel_index(m_pack->data, m_pack->pos, offsets, TEST_PARALLEL_RECORDS, NULL);
+
+	job = (struct umsgpack_parallel_job){
+		.data = m_pack->data, .len = m_pack->pos,
+		.offsets = offsets, .records = TEST_PARALLEL_RECORDS,
+		.chunk_records = TEST_PARALLEL_CHUNK, .threads = 4,
+		.work = test_parallel_work, .merge = test_parallel_merge, .ctx = &ctx,
+	};
+	mu_assert_int_eq(16, umsgpack_parallel_chunks(&job));
+	mu_check( umsgpack_parallel_run(&job) );
+	mu_assert_int_eq(16, ctx.nmerged);
+	for (size_t i = 0; i < ctx.nmerged; i++)
+		mu_assert_int_eq(i, ctx.merged[i]);
+	mu_check(ctx.total == expect);
+
+	/* a failing chunk fails the run */
+	memset(&ctx, 0, sizeof(ctx));
+	job.len--;
+	mu_check( !umsgpack_parallel_run(&job) );
+
+	/* merge() runs without blocking the workers */
+	{
+		struct test_parallel_block block = { .last = 15 };
+		mu_check( !pthread_mutex_init(&block.lock, NULL) );
+		job.len++;
+		job.work = test_parallel_block_work;
+		job.merge = test_parallel_block_merge;
+		job.ctx = &block;
+		mu_check( umsgpack_parallel_run(&job) );
+		pthread_mutex_destroy(&block.lock);
+	}
+}
+#ifdef UMSGPACK_GROWABLE
+#define TEST_PARALLEL_ELEMENTS 100000
+
+static uint32_t test_parallel_value(size_t i) {
+	return (uint32_t)(i * 2654435761u) >> (i % 32);
+}
+
+static size_t test_parallel_size(void *ctx, size_t i) {
+	size_t *bad = ctx;
+	return test_parallel_value(i) < 0x80 ? 1 : 5 + (i == *bad);
+}
+
+static int test_parallel_encode(void *ctx, struct umsgpack_packer_buf *buf, size_t i) {
+	uint32_t v = test_parallel_value(i);
+
+	/* written by hand: stats and trace counters are not thread safe */
+	if (v < 0x80) {
+		buf->data[buf->pos++] = (unsigned char)v;
+		return 1;
+	}
+	if (buf->length - buf->pos < 5)
+		return 0;
+	buf->data[buf->pos++] = 0xce;
+	for (int shift = 24; shift >= 0; shift -= 8)
+		buf->data[buf->pos++] = (unsigned char)(v >> shift);
+	return 1;
+}
+
+MU_TEST(test_parallel_pack) {
+	struct umsgpack_packer_buf buf;
+	struct umsgpack_obj obj;
+	size_t bad = (size_t)-1, off, n;
+	struct umsgpack_parallel_pack pk = {
+		.count = TEST_PARALLEL_ELEMENTS, .chunk_elements = 4096, .threads = 4,
+		.size = test_parallel_size, .encode = test_parallel_encode, .ctx = &bad,
+	};
+
+	mu_check( umsgpack_packer_grow_init(&buf, 0, NULL, NULL) );
+	mu_check( umsgpack_pack_nil(&buf) );
+	mu_check( umsgpack_parallel_pack_array(&buf, &pk) );
+
+	off = 1;
+	n = umsgpack_unpack_next(buf.data + off, buf.pos - off, &obj);
+	mu_assert_int_eq(5, n);
+	mu_assert_int_eq(0xdd, buf.data[off]);
+	mu_assert_int_eq(TEST_PARALLEL_ELEMENTS, obj.length);
+	off += n;
+	for (size_t i = 0; i < TEST_PARALLEL_ELEMENTS; i++) {
+		n = umsgpack_unpack_next(buf.data + off, buf.pos - off, &obj);
+		if (!n || obj.v.u != test_parallel_value(i))
+			break;
+		off += n;
+	}
+	mu_assert_int_eq(buf.pos, off);
+
+	/* a size that encode() does not match leaves the buffer untouched */
+	bad = 5000;
+	while (test_parallel_value(bad) < 0x80)
+		bad++;
+	off = buf.pos;
+	mu_check( !umsgpack_parallel_pack_array(&buf, &pk) );
+	mu_assert_int_eq(off, buf.pos);
+
+	pk.count = 0;
+	mu_check( umsgpack_parallel_pack_array(&buf, &pk) );
+	mu_assert_int_eq(0x90, buf.data[buf.pos - 1]);
+	umsgpack_packer_release(&buf);
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_POOL
+#define TEST_TPOOL_THREADS 4
+
+static struct umsgpack_tpool m_tpool;
+
+static void *test_tpool_worker(void *arg) {
+	struct umsgpack_packer_buf *bufs[3];
+	int *ok = arg;
+
+	*ok = 1;
+	for (int i = 0; i < 1000; i++) {
+		for (int j = 0; j < 3; j++) {
+			bufs[j] = umsgpack_alloc(32);
+			/* not packed: stats and trace counters are not thread safe */
+			if (!bufs[j] || bufs[j]->length != 32)
+				*ok = 0;
+			else
+				memset(bufs[j]->data, i, 32);
+		}
+		for (int j = 0; j < 3; j++)
+			umsgpack_free(bufs[j]);
+	}
+	return NULL;
+}
+
+MU_TEST(test_tpool) {
+	static uint64_t mem[512];
+	struct umsgpack_allocator a = UMSGPACK_TPOOL_ALLOCATOR(&m_tpool);
+	pthread_t threads[TEST_TPOOL_THREADS];
+	int ok[TEST_TPOOL_THREADS];
+	unsigned int n;
+
+	n = umsgpack_tpool_init(&m_tpool, mem, sizeof(mem), 32, 2);
+	mu_check(n >= TEST_TPOOL_THREADS * 4);
+	umsgpack_set_allocator(&a);
+	for (int i = 0; i < TEST_TPOOL_THREADS; i++)
+		mu_check(!pthread_create(&threads[i], NULL, test_tpool_worker, &ok[i]));
+	for (int i = 0; i < TEST_TPOOL_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		mu_check(ok[i]);
+	}
+	/* exited threads have returned their caches */
+	mu_assert_int_eq(n, m_tpool.pool.available);
+
+	m_pack = umsgpack_alloc(32);
+	mu_check(m_pack != NULL);
+	mu_check(m_tpool.pool.available < n);
+	umsgpack_free(m_pack);
+	m_pack = NULL;
+	umsgpack_tpool_destroy(&m_tpool);
+	mu_assert_int_eq(n, m_tpool.pool.available);
+	umsgpack_set_allocator(NULL);
+}
+#endif
+#endif
+
+#ifdef UMSGPACK_FUNC_SCHEMA
+struct test_schema_rec {
+	uint32_t id;
+	int8_t rssi;
+	int16_t level;
+	float temp;
+	double pressure;
+	uint8_t ok;
+	char name[8];
+	uint64_t uptime;
+};
+
+static const struct umsgpack_field test_schema_fields[] = {
+	UMSGPACK_FIELD(struct test_schema_rec, id, UMSGPACK_FIELD_UINT),
+	UMSGPACK_FIELD(struct test_schema_rec, rssi, UMSGPACK_FIELD_INT),
+	UMSGPACK_FIELD(struct test_schema_rec, level, UMSGPACK_FIELD_INT),
+	UMSGPACK_FIELD_KEY(struct test_schema_rec, temp, UMSGPACK_FIELD_FLOAT, "degC"),
+	UMSGPACK_FIELD(struct test_schema_rec, pressure, UMSGPACK_FIELD_FLOAT),
+	UMSGPACK_FIELD(struct test_schema_rec, ok, UMSGPACK_FIELD_BOOL),
+	UMSGPACK_FIELD(struct test_schema_rec, name, UMSGPACK_FIELD_STR),
+	UMSGPACK_FIELD(struct test_schema_rec, uptime, UMSGPACK_FIELD_UINT),
+};
+
+MU_TEST(test_schema) {
+	const size_t data_size = 128;
+	const uint8_t count = sizeof(test_schema_fields) / sizeof(test_schema_fields[0]);
+	struct umsgpack_schema schema;
+	struct test_schema_rec rec = { .level = 99 };
+	uint8_t table[16];
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	mu_check( umsgpack_schema_init(&schema, test_schema_fields, count, table, sizeof(table)) );
+
+	mu_check( umsgpack_pack_map(m_pack, 10) );
+	mu_check( umsgpack_pack_str(m_pack, "name", 4) );
+	mu_check( umsgpack_pack_str(m_pack, "node7", 5) );
+	mu_check( umsgpack_pack_str(m_pack, "extra", 5) );
+	mu_check( umsgpack_pack_map(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "id", 2) );
+	mu_check( umsgpack_pack_uint(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "id", 2) );
+	mu_check( umsgpack_pack_uint32(m_pack, 70000) );
+	mu_check( umsgpack_pack_str(m_pack, "rssi", 4) );
+	mu_check( umsgpack_pack_int(m_pack, -128) );
+	mu_check( umsgpack_pack_str(m_pack, "level", 5) );
+	mu_check( umsgpack_pack_nil(m_pack) );
+	mu_check( umsgpack_pack_str(m_pack, "degC", 4) );
+	mu_check( umsgpack_pack_float(m_pack, 21.5f) );
+	mu_check( umsgpack_pack_str(m_pack, "pressure", 8) );
+	mu_check( umsgpack_pack_uint(m_pack, 1013) );
+	mu_check( umsgpack_pack_str(m_pack, "ok", 2) );
+	mu_check( umsgpack_pack_bool(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "uptime", 6) );
+	mu_check( umsgpack_pack_uint64(m_pack, 0x100000000ULL) );
+	mu_check( umsgpack_pack_uint(m_pack, 3) );
+	mu_check( umsgpack_pack_uint(m_pack, 4) );
+
+	mu_assert_int_eq(m_pack->pos, umsgpack_unpack_struct(&schema, m_pack->data, m_pack->pos, &rec));
+	mu_assert_int_eq(70000, rec.id);
+	mu_assert_int_eq(-128, rec.rssi);
+	mu_assert_int_eq(99, rec.level);
+	mu_assert_double_eq(21.5, rec.temp);
+	mu_assert_double_eq(1013.0, rec.pressure);
+	mu_assert_int_eq(1, rec.ok);
+	mu_assert_string_eq("node7", rec.name);
+	mu_check(rec.uptime == 0x100000000ULL);
+
+	/* values that do not fit their member */
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_map(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "rssi", 4) );
+	mu_check( umsgpack_pack_int(m_pack, -129) );
+	mu_assert_int_eq(0, umsgpack_unpack_struct(&schema, m_pack->data, m_pack->pos, &rec));
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_map(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "level", 5) );
+	mu_check( umsgpack_pack_uint(m_pack, 0x8000) );
+	mu_assert_int_eq(0, umsgpack_unpack_struct(&schema, m_pack->data, m_pack->pos, &rec));
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_map(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "name", 4) );
+	mu_check( umsgpack_pack_str(m_pack, "eightchr", 8) );
+	mu_assert_int_eq(0, umsgpack_unpack_struct(&schema, m_pack->data, m_pack->pos, &rec));
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_map(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "id", 2) );
+	mu_check( umsgpack_pack_int(m_pack, -1) );
+	mu_assert_int_eq(0, umsgpack_unpack_struct(&schema, m_pack->data, m_pack->pos, &rec));
+
+	/* keys with embedded NULs are unknown keys, skipped */
+	for (uint8_t i = 0; i < count; i++) {
+		char key[24] = { 0 };
+		size_t len = strlen(test_schema_fields[i].key);
+		memcpy(key, test_schema_fields[i].key, len);
+		for (size_t pad = 1; pad <= 8; pad++) {
+			rec.id = 42;
+			m_pack->pos = 0;
+			mu_check( umsgpack_pack_map(m_pack, 1) );
+			mu_check( umsgpack_pack_str(m_pack, key, (uint32_t)(len + pad)) );
+			mu_check( umsgpack_pack_uint(m_pack, 7) );
+			mu_assert_int_eq(m_pack->pos, umsgpack_unpack_struct(&schema, m_pack->data, m_pack->pos, &rec));
+			mu_assert_int_eq(42, rec.id);
+		}
+	}
+
+#ifdef UMSGPACK_FUNC_DICT
+	{
+		const char *const keys[] = { "degC", "id" };
+		struct umsgpack_dict dict;
+		uint8_t dict_table[4];
+		mu_check( umsgpack_dict_init(&dict, 1, keys, 2, dict_table, sizeof(dict_table)) );
+		schema.dict = &dict;
+		m_pack->pos = 0;
+		mu_check( umsgpack_pack_map(m_pack, 2) );
+		mu_check( umsgpack_pack_key(m_pack, &dict, "degC", 4) );
+		mu_check( umsgpack_pack_int(m_pack, -3) );
+		mu_check( umsgpack_pack_key(m_pack, &dict, "id", 2) );
+		mu_check( umsgpack_pack_uint(m_pack, 5) );
+		mu_assert_int_eq(m_pack->pos, umsgpack_unpack_struct(&schema, m_pack->data, m_pack->pos, &rec));
+		mu_assert_double_eq(-3.0, rec.temp);
+		mu_assert_int_eq(5, rec.id);
+	}
+#endif
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_DOM
+MU_TEST(test_dom) {
+	const size_t data_size = 128;
+	static struct umsgpack_node mem[16];
+	struct umsgpack_arena arena;
+	const struct umsgpack_node *root, *n;
+	size_t consumed;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	mu_assert_int_eq(16, sizeof(struct umsgpack_node));
+	umsgpack_arena_init(&arena, mem, sizeof(mem));
+
+	/* {"id": 7, "v": [-1, 2.5, "abc", []], "m": {}} */
+	mu_check( umsgpack_pack_map(m_pack, 3) );
+	mu_check( umsgpack_pack_str(m_pack, "id", 2) );
+	mu_check( umsgpack_pack_uint(m_pack, 7) );
+	mu_check( umsgpack_pack_str(m_pack, "v", 1) );
+	mu_check( umsgpack_pack_array(m_pack, 4) );
+	mu_check( umsgpack_pack_int(m_pack, -1) );
+	mu_check( umsgpack_pack_float(m_pack, 2.5f) );
+	mu_check( umsgpack_pack_str(m_pack, "abc", 3) );
+	mu_check( umsgpack_pack_array(m_pack, 0) );
+	mu_check( umsgpack_pack_str(m_pack, "m", 1) );
+	mu_check( umsgpack_pack_map(m_pack, 0) );
+	mu_check( umsgpack_pack_nil(m_pack) );
+
+	root = umsgpack_dom_parse(&arena, m_pack->data, m_pack->pos, &consumed);
+	mu_check(root != NULL);
+	mu_assert_int_eq(m_pack->pos - 1, consumed);
+	/* root + 6 map children + 4 array elements */
+	mu_assert_int_eq(11 * sizeof(struct umsgpack_node), arena.used);
+	mu_assert_int_eq(UMSGPACK_TYPE_MAP, root->type);
+	mu_assert_int_eq(3, root->length);
+
+	n = umsgpack_node_get(root, "id", 2);
+	mu_check(n != NULL && n->type == UMSGPACK_TYPE_UINT && n->v.u == 7);
+	n = umsgpack_node_get(root, "v", 1);
+	mu_check(n != NULL && n->type == UMSGPACK_TYPE_ARRAY && n->length == 4);
+	mu_check(umsgpack_node_at(n, 0)->v.i == -1);
+	mu_assert_double_eq(2.5, umsgpack_node_at(n, 1)->v.f);
+	mu_check(umsgpack_node_at(n, 2)->length == 3 && !memcmp(umsgpack_node_at(n, 2)->v.ptr, "abc", 3));
+	mu_check(umsgpack_node_at(n, 3)->type == UMSGPACK_TYPE_ARRAY && !umsgpack_node_at(n, 3)->length);
+	mu_check(umsgpack_node_at(n, 4) == NULL);
+	mu_check(umsgpack_node_get(root, "m", 1)->type == UMSGPACK_TYPE_MAP);
+	mu_check(umsgpack_node_get(root, "x", 1) == NULL);
+	mu_check(umsgpack_node_at(root, 0) == NULL);
+
+	/* failures leave the arena untouched */
+	mu_check(umsgpack_dom_parse(&arena, m_pack->data, consumed - 1, NULL) == NULL);
+	mu_assert_int_eq(11 * sizeof(struct umsgpack_node), arena.used);
+	mu_check(umsgpack_dom_parse(&arena, m_pack->data, consumed, NULL) == NULL);
+	mu_assert_int_eq(11 * sizeof(struct umsgpack_node), arena.used);
+
+	umsgpack_arena_reset(&arena);
+	mu_check(umsgpack_dom_parse(&arena, m_pack->data, consumed, NULL) == root);
+
+	/* nesting limit */
+	m_pack->pos = 0;
+	for (int i = 0; i <= UMSGPACK_DOM_MAX_DEPTH; i++)
+		mu_check( umsgpack_pack_array(m_pack, 1) );
+	mu_check( umsgpack_pack_nil(m_pack) );
+	umsgpack_arena_reset(&arena);
+	mu_check(umsgpack_dom_parse(&arena, m_pack->data, m_pack->pos, NULL) == NULL);
+	mu_check(umsgpack_dom_parse(&arena, m_pack->data + 1, m_pack->pos - 1, NULL) == NULL);
+	mu_assert_int_eq(0, arena.used);
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_POOL
+MU_TEST(test_pool) {
+	static uint64_t mem[64];
+	struct umsgpack_pool pool;
+	struct umsgpack_allocator a = UMSGPACK_POOL_ALLOCATOR(&pool);
+	struct umsgpack_packer_buf *bufs[4];
+	unsigned int n;
+
+	n = umsgpack_pool_init(&pool, mem, sizeof(mem), 100);
+	mu_check(n >= 3);
+	mu_check(pool.slab_size >= 100 + sizeof(struct umsgpack_packer_buf));
+	mu_assert_int_eq(n, pool.available);
+
+	umsgpack_set_allocator(&a);
+	for (unsigned int i = 0; i < n; i++) {
+		struct umsgpack_packer_buf *buf = umsgpack_alloc(100);
+		mu_check(buf != NULL);
+		mu_check((unsigned char *)buf >= (unsigned char *)mem &&
+		         (unsigned char *)buf + pool.slab_size <= (unsigned char *)mem + sizeof(mem));
+		if (i < 4)
+			bufs[i] = buf;
+		else
+			umsgpack_free(buf);
+	}
+	mu_check(n > 4 || umsgpack_alloc(1) == NULL);
+	for (unsigned int i = 0; i < 4 && i < n; i++)
+		umsgpack_free(bufs[i]);
+	mu_assert_int_eq(n, pool.available);
+
+	/* larger than a slab */
+	mu_check(umsgpack_alloc(101 + pool.slab_size) == NULL);
+	bufs[0] = umsgpack_alloc(10);
+	mu_check(bufs[0] != NULL);
+	mu_assert_int_eq(10, bufs[0]->length);
+	mu_check( umsgpack_pack_uint(bufs[0], 1) );
+	umsgpack_free(bufs[0]);
+
+	umsgpack_set_allocator(NULL);
+}
+#endif
+
+#ifdef UMSGPACK_GROWABLE
+struct test_grow_ctx {
+	int calls;
+	size_t limit;
+};
+
+static void *test_grow_realloc(void *ctx, void *ptr, size_t size) {
+	struct test_grow_ctx *c = ctx;
+	c->calls++;
+	if (!size) {
+		free(ptr);
+		return NULL;
+	}
+	return size > c->limit ? NULL : realloc(ptr, size);
+}
+
+MU_TEST(test_growable) {
+	struct test_grow_ctx ctx = { .limit = 4096 };
+	struct umsgpack_packer_buf buf;
+	char ptn[256];
+
+	mu_check( umsgpack_packer_grow_init(&buf, 0, test_grow_realloc, &ctx) );
+	mu_assert_int_eq(0, buf.length);
+	mu_check( umsgpack_pack_array(&buf, 0xffff) );
+	mu_assert_int_eq(64, buf.length);
+	for (int i = 0; i < 1000; i++)
+		mu_check( umsgpack_pack_uint(&buf, i) );
+	/* 2619 bytes: 64 -> 128 -> ... -> 4096 */
+	mu_assert_int_eq(3 + 128 + 128 * 2 + 744 * 3, buf.pos);
+	mu_assert_int_eq(4096, buf.length);
+	mu_assert_int_eq(7, ctx.calls);
+	mu_assert_int_eq(0xdc, buf.data[0]);
+	mu_assert_int_eq(0xcd, buf.data[buf.pos - 3]);
+	mu_assert_int_eq(999 >> 8, buf.data[buf.pos - 2]);
+	mu_assert_int_eq(999 & 0xff, buf.data[buf.pos - 1]);
+
+	mu_check( umsgpack_packer_shrink(&buf) );
+	mu_assert_int_eq(buf.pos, buf.length);
+
+	/* a failed reallocation fails the pack and keeps the data */
+	generate_pattern(ptn, sizeof(ptn));
+	ctx.limit = buf.length;
+	mu_check( !umsgpack_pack_str(&buf, ptn, 200) );
+	mu_assert_int_eq(3 + 128 + 128 * 2 + 744 * 3, buf.pos);
+	mu_assert_int_eq(0xcd, buf.data[buf.pos - 3]);
+	ctx.limit = 1 << 20;
+	mu_check( umsgpack_pack_str(&buf, ptn, 200) );
+	mu_assert_int_eq(2 * (3 + 128 + 128 * 2 + 744 * 3), buf.length);
+
+	umsgpack_packer_reset(&buf);
+	mu_assert_int_eq(0, buf.pos);
+	mu_check( umsgpack_pack_nil(&buf) );
+	mu_assert_int_eq(0xc0, buf.data[0]);
+
+	ctx.calls = 0;
+	umsgpack_packer_release(&buf);
+	mu_assert_int_eq(1, ctx.calls);
+	mu_check(buf.data == NULL);
+	mu_check( umsgpack_pack_nil(&buf) );
+	umsgpack_packer_release(&buf);
+
+	/* default realloc() */
+	mu_check( umsgpack_packer_grow_init(&buf, 4, NULL, NULL) );
+	mu_check( umsgpack_pack_str(&buf, ptn, 200) );
+	mu_assert_int_eq(202, buf.pos);
+	umsgpack_packer_release(&buf);
+
+#if defined(UMSGPACK_FUNC_JSON) && defined(UMSGPACK_FUNC_UNPACK)
+	/* widening a JSON container header grows the buffer too */
+	{
+		const char json[] = "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15]";
+		struct umsgpack_obj obj;
+		mu_check( umsgpack_packer_grow_init(&buf, 17, NULL, NULL) );
+		mu_check( umsgpack_pack_json(&buf, json, sizeof(json) - 1) );
+		mu_assert_int_eq(3 + 16, buf.pos);
+		mu_assert_int_eq(3, umsgpack_unpack_next(buf.data, buf.pos, &obj));
+		mu_assert_int_eq(16, obj.length);
+		mu_assert_int_eq(15, buf.data[buf.pos - 1]);
+		umsgpack_packer_release(&buf);
+	}
+#endif
+
+	/* fixed buffers do not grow */
+	m_pack = umsgpack_alloc(1);
+	mu_check( umsgpack_pack_nil(m_pack) );
+	mu_check( !umsgpack_pack_nil(m_pack) );
+}
+#endif
+
+#if defined(UMSGPACK_FUNC_CHAIN) && defined(UMSGPACK_FUNC_POOL)
+static int test_chain_pack(struct umsgpack_packer_buf *buf, const char *ptn) {
+	int ok = umsgpack_pack_map(buf, 4);
+	ok = ok && umsgpack_pack_str(buf, "raw", 3);
+	ok = ok && umsgpack_pack_ext(buf, 9, ptn, 40);
+	ok = ok && umsgpack_pack_str(buf, "id", 2);
+	ok = ok && umsgpack_pack_uint32(buf, 0x12345678);
+	ok = ok && umsgpack_pack_str(buf, "blob", 4);
+	ok = ok && umsgpack_pack_str(buf, ptn, 100);
+	ok = ok && umsgpack_pack_str(buf, "v", 1);
+	ok = ok && umsgpack_pack_array(buf, 20);
+	for (int i = 0; i < 20; i++)
+		ok = ok && umsgpack_pack_uint16(buf, 1000 + i);
+	return ok;
+}
+
+MU_TEST(test_chain) {
+	const size_t data_size = 256;
+	static uint64_t mem[320];
+	struct umsgpack_pool pool;
+	struct umsgpack_allocator a = UMSGPACK_POOL_ALLOCATOR(&pool);
+	struct umsgpack_chain chain;
+	struct umsgpack_packer_buf buf;
+	struct umsgpack_segment segs[32];
+	unsigned char out[512];
+	unsigned int n, slabs;
+	size_t len = 0;
+	char ptn[256];
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	generate_pattern(ptn, sizeof(ptn));
+	mu_check( test_chain_pack(m_pack, ptn) );
+
+	/* slabs are sized for packer buffers, roomy enough for a chunk */
+	slabs = umsgpack_pool_init(&pool, mem, sizeof(mem), 16 + sizeof(struct umsgpack_chunk));
+	mu_check(slabs >= 16);
+	mu_check( umsgpack_chain_init(&buf, &chain, &a, 16) );
+	mu_check( test_chain_pack(&buf, ptn) );
+	mu_assert_int_eq(m_pack->pos, umsgpack_chain_length(&buf));
+
+	n = umsgpack_chain_segments(&buf, segs, 16);
+	mu_check(n > 1 && n <= 16);
+	for (unsigned int i = 0; i < n; i++) {
+		mu_check(segs[i].length <= 16);
+		memcpy(out + len, segs[i].data, segs[i].length);
+		len += segs[i].length;
+	}
+	mu_assert_int_eq(m_pack->pos, len);
+	mu_check(!memcmp(m_pack->data, out, len));
+	mu_assert_int_eq(n, umsgpack_chain_segments(&buf, segs, 1));
+
+#ifdef UMSGPACK_FUNC_TYPED
+	/* typed payloads are aligned within the whole output, not the chunk */
+	for (int k = 0; k < 8; k++) {
+		const int32_t values[3] = { 1, -2, 3 };
+		size_t start, hdr;
+		umsgpack_chain_reset(&buf);
+		mu_check( test_chain_pack(&buf, ptn) );
+		for (int j = 0; j < k; j++)
+			mu_check( umsgpack_pack_nil(&buf) );
+		start = umsgpack_chain_length(&buf);
+		mu_check( umsgpack_pack_typed(&buf, UMSGPACK_TYPED_INT32, values, 3) );
+		n = umsgpack_chain_segments(&buf, segs, 32);
+		mu_check(n <= 32);
+		len = 0;
+		for (unsigned int i = 0; i < n; i++) {
+			memcpy(out + len, segs[i].data, segs[i].length);
+			len += segs[i].length;
+		}
+		mu_assert_int_eq(0xc7, out[start]);
+		hdr = start + 3 + 1 + out[start + 3];
+		mu_assert_int_eq(0, hdr % 4);
+		mu_assert_int_eq(start + 3 + out[start + 1], len);
+		mu_assert_int_eq(-2, (int8_t)out[hdr + 4]);
+	}
+	umsgpack_chain_reset(&buf);
+	mu_check( test_chain_pack(&buf, ptn) );
+#endif
+
+	/* writers that rewind or patch refuse chains; the log copies every chunk */
+	len = umsgpack_chain_length(&buf);
+#ifdef UMSGPACK_FUNC_DELTA
+	{
+		union umsgpack_delta_value values[3], rec[3] = { { .f = 1.5F }, { .i = 2 }, { .i = 1 } };
+		struct umsgpack_delta delta;
+		umsgpack_delta_init(&delta, m_delta_fields, values, 3, 3);
+		mu_check( !umsgpack_pack_delta(&buf, &delta, rec) );
+		mu_assert_int_eq(len, umsgpack_chain_length(&buf));
+	}
+#endif
+#ifdef UMSGPACK_FUNC_JSON
+	mu_check( !umsgpack_pack_json(&buf, "[1,2]", 5) );
+	mu_assert_int_eq(len, umsgpack_chain_length(&buf));
+#endif
+#ifdef UMSGPACK_FUNC_LOG
+	{
+		struct umsgpack_log log;
+		const unsigned char *rec;
+		size_t rec_len;
+		uint64_t ts;
+		remove(TEST_LOG_PATH);
+		remove(TEST_LOG_INDEX_PATH);
+		mu_check( umsgpack_log_open(&log, TEST_LOG_PATH, TEST_LOG_INDEX_PATH, 512, 2) );
+		mu_check( umsgpack_log_append(&log, &buf, 1) );
+		rec = umsgpack_log_get(&log, 0, &rec_len, &ts);
+		mu_check(rec != NULL);
+		mu_assert_int_eq(m_pack->pos, rec_len);
+		mu_check(!memcmp(m_pack->data, rec, rec_len));
+		umsgpack_log_close(&log);
+		remove(TEST_LOG_PATH);
+		remove(TEST_LOG_INDEX_PATH);
+	}
+#endif
+
+	/* a str that cannot get enough chunks fails without writing */
+	len = umsgpack_chain_length(&buf);
+	n = pool.available;
+	mu_check( !umsgpack_pack_str(&buf, ptn, (n + 1) * 16) );
+	mu_assert_int_eq(len, umsgpack_chain_length(&buf));
+	mu_check( umsgpack_pack_nil(&buf) );
+	mu_assert_int_eq(len + 1, umsgpack_chain_length(&buf));
+	/* reservations must be contiguous */
+	mu_check( !umsgpack_pack_str(&buf, NULL, 16) );
+	mu_check( umsgpack_pack_str(&buf, NULL, 15) );
+
+	umsgpack_chain_reset(&buf);
+	mu_assert_int_eq(0, umsgpack_chain_length(&buf));
+	mu_assert_int_eq(0, umsgpack_chain_segments(&buf, segs, 16));
+	mu_check( umsgpack_pack_bool(&buf, 1) );
+	mu_assert_int_eq(1, umsgpack_chain_length(&buf));
+	umsgpack_chain_free(&buf);
+	mu_assert_int_eq(slabs, pool.available);
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_TYPED
+MU_TEST(test_typed) {
+	const size_t data_size = 1200;
+	int16_t samples[512], out16[512];
+	int32_t counts[3] = { -1, 0x12345678, 7 }, out32[3];
+	float temps[2] = { 21.5f, -3.25f }, outf[2];
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	for (int i = 0; i < 512; i++)
+		samples[i] = (int16_t)(i * 97 - 20000);
+
+	/* 1 + 3 byte ext16 header + type, 1 pad length byte: no padding */
+	mu_check( umsgpack_pack_nil(m_pack) );
+	mu_check( umsgpack_pack_typed(m_pack, UMSGPACK_TYPED_INT16, samples, 512) );
+	mu_assert_int_eq(1 + 4 + 1 + 1024, m_pack->pos);
+	mu_assert_int_eq(0xc8, m_pack->data[1]);
+	mu_assert_int_eq(UMSGPACK_EXT_TYPED + UMSGPACK_TYPED_INT16, m_pack->data[4]);
+	mu_assert_int_eq(0, m_pack->data[5]);
+	mu_assert_int_eq(samples[0] & 0xff, m_pack->data[6]);
+	mu_assert_int_eq((samples[0] >> 8) & 0xff, m_pack->data[7]);
+	mu_check( umsgpack_pack_typed(m_pack, UMSGPACK_TYPED_INT32, counts, 3) );
+	mu_check( umsgpack_pack_typed(m_pack, UMSGPACK_TYPED_FLOAT32, temps, 2) );
+	mu_check( !umsgpack_pack_typed(m_pack, 3, counts, 1) );
+	mu_check( !umsgpack_pack_typed(m_pack, UMSGPACK_TYPED_INT16, samples, 512) );
+
+#ifdef UMSGPACK_FUNC_UNPACK
+	{
+		struct umsgpack_obj obj;
+		struct umsgpack_typed_view view;
+		size_t off = 1, n;
+
+		n = umsgpack_unpack_next(m_pack->data + off, m_pack->pos - off, &obj);
+		mu_check( umsgpack_unpack_typed(&obj, &view) );
+		mu_assert_int_eq(UMSGPACK_TYPED_INT16, view.kind);
+		mu_assert_int_eq(512, view.count);
+		mu_assert_int_eq(0, ((const unsigned char *)view.data - m_pack->data) % 2);
+		mu_assert_int_eq(512, umsgpack_typed_copy(&view, out16, 512));
+		mu_check(!memcmp(samples, out16, sizeof(samples)));
+		if (view.direct)
+			mu_assert_int_eq(samples[511], ((const int16_t *)view.data)[511]);
+		off += n;
+
+		n = umsgpack_unpack_next(m_pack->data + off, m_pack->pos - off, &obj);
+		mu_check( umsgpack_unpack_typed(&obj, &view) );
+		mu_assert_int_eq(UMSGPACK_TYPED_INT32, view.kind);
+		mu_assert_int_eq(0, ((const unsigned char *)view.data - m_pack->data) % 4);
+		mu_assert_int_eq(2, umsgpack_typed_copy(&view, out32, 2));
+		mu_assert_int_eq(-1, out32[0]);
+		mu_assert_int_eq(0x12345678, out32[1]);
+		off += n;
+
+		n = umsgpack_unpack_next(m_pack->data + off, m_pack->pos - off, &obj);
+		mu_check( umsgpack_unpack_typed(&obj, &view) );
+		mu_assert_int_eq(2, umsgpack_typed_copy(&view, outf, 2));
+		mu_assert_double_eq(-3.25, outf[1]);
+		off += n;
+		mu_assert_int_eq(m_pack->pos, off);
+
+		/* plain ext or malformed padding */
+		mu_check( umsgpack_unpack_next(m_pack->data, 1, &obj) );
+		mu_check( !umsgpack_unpack_typed(&obj, &view) );
+		{
+			const unsigned char bad[] = { 0xd5, UMSGPACK_EXT_TYPED, 0x02, 0x00 };
+			mu_check( umsgpack_unpack_next(bad, sizeof(bad), &obj) );
+			mu_check( !umsgpack_unpack_typed(&obj, &view) );
+		}
+	}
+#endif
+}
+#endif
+
+#ifdef UMSGPACK_WRAP
+MU_TEST(test_wrap) {
+	struct umsgpack_packer_buf buf;
+	unsigned char mem[8];
+	const unsigned char expects[] = { 0x92, 0xcd, 0x12, 0x34, 0xa2, 'o', 'k' };
+
+	umsgpack_packer_wrap(&buf, mem, sizeof(mem));
+	mu_check( umsgpack_pack_array(&buf, 2) );
+	mu_check( umsgpack_pack_uint(&buf, 0x1234) );
+	mu_check( umsgpack_pack_str(&buf, "ok", 2) );
+	mu_assert_int_eq(sizeof(expects), umsgpack_get_length((&buf)));
+	mu_check( buf.data == mem );
+	mu_check( !memcmp(mem, expects, sizeof(expects)) );
+	mu_check( !umsgpack_pack_uint(&buf, 0x1234) );
+	mu_assert_int_eq(sizeof(expects), buf.pos);
+
+	/* the length is capped at what umsgpack_size_t can count */
+	umsgpack_packer_wrap(&buf, mem, (size_t)UMSGPACK_SIZE_MAX + 1);
+	mu_assert_int_eq(UMSGPACK_SIZE_MAX, buf.length);
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_HASH
+MU_TEST(test_hash) {
+	const size_t data_size = 512;
+	struct umsgpack_hash h, rx;
+	char ptn[256];
+	uint64_t digest;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	generate_pattern(ptn, sizeof(ptn));
+	/* any split of the input gives the same digest */
+	digest = umsgpack_hash(ptn, sizeof(ptn), 1);
+	for (size_t step = 1; step <= 13; step += 3) {
+		umsgpack_hash_init(&h, 1);
+		for (size_t off = 0; off < sizeof(ptn); off += step)
+			umsgpack_hash_update(&h, ptn + off, sizeof(ptn) - off < step ? sizeof(ptn) - off : step);
+		mu_check(umsgpack_hash_digest(&h) == digest);
+	}
+	mu_check(umsgpack_hash(ptn, sizeof(ptn), 2) != digest);
+	mu_check(umsgpack_hash(ptn, sizeof(ptn) - 1, 1) != digest);
+	ptn[100] ^= 1;
+	mu_check(umsgpack_hash(ptn, sizeof(ptn), 1) != digest);
+	ptn[100] ^= 1;
+
+	/* packer hash covers the bytes packed after it is attached */
+	mu_check(umsgpack_packer_digest(m_pack) == 0);
+	mu_check( umsgpack_pack_nil(m_pack) );
+	umsgpack_hash_init(&h, 0);
+	umsgpack_packer_hash(m_pack, &h);
+	mu_check( umsgpack_pack_map(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "raw", 3) );
+	mu_check( umsgpack_pack_bin(m_pack, ptn, 200) );
+	digest = umsgpack_packer_digest(m_pack);
+	mu_check(digest == umsgpack_hash(m_pack->data + 1, m_pack->pos - 1, 0));
+	mu_check( umsgpack_pack_uint(m_pack, 7) );
+	mu_check(umsgpack_packer_digest(m_pack) == umsgpack_hash(m_pack->data + 1, m_pack->pos - 1, 0));
+
+	/* receiver: delimit and hash in one pass */
+	umsgpack_hash_init(&rx, 0);
+	mu_assert_int_eq(m_pack->pos - 2, umsgpack_skip_hash(m_pack->data + 1, m_pack->pos - 1, &rx));
+	mu_check(umsgpack_hash_digest(&rx) == digest);
+	mu_assert_int_eq(0, umsgpack_skip_hash(m_pack->data + 1, 10, &rx));
+	mu_check(umsgpack_hash_digest(&rx) == digest);
+
+#if defined(UMSGPACK_FUNC_CHAIN) && defined(UMSGPACK_FUNC_POOL)
+	{
+		static uint64_t mem[320];
+		struct umsgpack_pool pool;
+		struct umsgpack_allocator a = UMSGPACK_POOL_ALLOCATOR(&pool);
+		struct umsgpack_chain chain;
+		struct umsgpack_packer_buf buf;
+
+		/* chunks are folded in as they are closed */
+		m_pack->pos = 0;
+		mu_check( test_chain_pack(m_pack, ptn) );
+		umsgpack_pool_init(&pool, mem, sizeof(mem), 16 + sizeof(struct umsgpack_chunk));
+		mu_check( umsgpack_chain_init(&buf, &chain, &a, 16) );
+		umsgpack_hash_init(&h, 0);
+		umsgpack_packer_hash(&buf, &h);
+		mu_check( test_chain_pack(&buf, ptn) );
+		mu_check(umsgpack_packer_digest(&buf) == umsgpack_hash(m_pack->data, m_pack->pos, 0));
+		umsgpack_chain_free(&buf);
+	}
+#endif
+}
+#endif
+
+#ifdef UMSGPACK_STATS
+MU_TEST(test_stats) {
+	const size_t data_size = FORMAT_MAX_SIZE;
+	struct umsgpack_stats stats;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	umsgpack_stats_reset();
+	mu_check( umsgpack_pack_map(m_pack, 1) );
+	mu_check( umsgpack_pack_str(m_pack, "degC", 4) );
+	mu_check( umsgpack_pack_uint(m_pack, 0x1234) );
+	mu_check( !umsgpack_pack_str(m_pack, "humidity", 8) );
+	umsgpack_stats_snapshot(&stats);
+
+	mu_assert_int_eq(1, stats.formats[UMSGPACK_STATS_INDEX(0x81)]);
+	mu_assert_int_eq(1, stats.formats[UMSGPACK_STATS_INDEX(0xa4)]);
+	mu_assert_int_eq(1, stats.formats[UMSGPACK_STATS_INDEX(0xcd)]);
+	mu_assert_int_eq(0, stats.formats[UMSGPACK_STATS_INDEX(0xcc)]);
+	mu_assert_int_eq(1+5+3, stats.bytes);
+	mu_assert_int_eq(1, stats.overflows);
+	mu_assert_int_eq(1+5+3, stats.largest);
+
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_int(m_pack, -1) );
+	umsgpack_stats_snapshot(&stats);
+	mu_assert_int_eq(1, stats.formats[UMSGPACK_STATS_INDEX(0xff)]);
+	mu_assert_int_eq(1+5+3, stats.largest);
+
+	/* a widened placeholder counts once, as the header finally written */
+	{
+		struct umsgpack_packer_buf *buf = umsgpack_alloc(32);
+		mu_check(buf != NULL);
+		umsgpack_stats_reset();
+		mu_check( umsgpack_pack_array(buf, 0) );
+		for (unsigned int i = 0; i < 16; i++)
+			mu_check( umsgpack_pack_uint(buf, i) );
+		mu_check( umsgpack_patch_container(buf, 0, 16) );
+		umsgpack_stats_snapshot(&stats);
+		mu_assert_int_eq(0xdc, buf->data[0]);
+		mu_assert_int_eq(15, buf->data[18]);
+		mu_assert_int_eq(0, stats.formats[UMSGPACK_STATS_INDEX(0x90)]);
+		mu_assert_int_eq(1, stats.formats[UMSGPACK_STATS_INDEX(0xdc)]);
+		mu_assert_int_eq(16, stats.formats[UMSGPACK_STATS_INDEX(0x00)]);
+		mu_assert_int_eq(buf->pos, stats.bytes);
+		mu_assert_int_eq(buf->pos, stats.largest);
+#if defined(UMSGPACK_FUNC_JSON) && defined(UMSGPACK_FUNC_UNPACK)
+		{
+			const char json[] = "{\"a\":[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16]}";
+			buf->pos = 0;
+			umsgpack_stats_reset();
+			mu_check( umsgpack_pack_json(buf, json, sizeof(json) - 1) );
+			umsgpack_stats_snapshot(&stats);
+			mu_assert_int_eq(1, stats.formats[UMSGPACK_STATS_INDEX(0x81)]);
+			mu_assert_int_eq(0, stats.formats[UMSGPACK_STATS_INDEX(0x90)]);
+			mu_assert_int_eq(1, stats.formats[UMSGPACK_STATS_INDEX(0xdc)]);
+			mu_assert_int_eq(buf->pos, stats.bytes);
+		}
+#endif
+		umsgpack_free(buf);
+	}
+}
+#endif
+
+#ifdef UMSGPACK_TRACE
+static uint32_t m_trace_clock = 0;
+static uint32_t m_trace_step = 1;
+
+uint32_t umsgpack_trace_cycles(void) {
+	m_trace_clock += m_trace_step;
+	return m_trace_clock;
+}
+
+MU_TEST(test_trace) {
+	const size_t data_size = FORMAT_MAX_SIZE;
+	const struct umsgpack_trace_hist *hist;
+	m_pack = umsgpack_alloc(data_size);
+	if (!m_pack) {
+		fprintf(stderr, "%s: failed umsgpack_alloc(%lu). skip test.\n", __func__, data_size);
+		return;
+	}
+
+	umsgpack_trace_reset();
+	m_trace_step = 100;
+	for (int i = 0; i < 99; i++) {
+		mu_check( umsgpack_pack_nil(m_pack) );
+		m_pack->pos = 0;
+	}
+	m_trace_step = 5000;
+	mu_check( umsgpack_pack_nil(m_pack) );
+	m_trace_step = 1;
+
+	hist = umsgpack_trace_get(UMSGPACK_TRACE_NIL);
+	mu_check(hist != NULL);
+	mu_assert_int_eq(100, hist->count);
+	mu_assert_int_eq(5000, hist->max);
+	mu_assert_int_eq(99, hist->buckets[6]);	/* 64..127 */
+	mu_assert_int_eq(1, hist->buckets[12]);	/* 4096..8191 */
+	mu_assert_int_eq(127, umsgpack_trace_percentile(UMSGPACK_TRACE_NIL, 500));
+	mu_assert_int_eq(127, umsgpack_trace_percentile(UMSGPACK_TRACE_NIL, 990));
+	mu_assert_int_eq(5000, umsgpack_trace_percentile(UMSGPACK_TRACE_NIL, 1000));
+	mu_assert_int_eq(0, umsgpack_trace_get(UMSGPACK_TRACE_MAP)->count);
+
+	/* entry points that share a format still get their own slot */
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_fixed_as_float(m_pack, 3, 1) );
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_double_compact(m_pack, 1.5) );
+	m_pack->pos = 0;
+	mu_check( umsgpack_pack_double_narrow(m_pack, 1.5) );
+	mu_assert_int_eq(0, umsgpack_trace_get(UMSGPACK_TRACE_FLOAT)->count);
+	mu_assert_int_eq(0, umsgpack_trace_get(UMSGPACK_TRACE_DOUBLE)->count);
+	mu_assert_int_eq(1, umsgpack_trace_get(UMSGPACK_TRACE_FIXED_AS_FLOAT)->count);
+	mu_assert_int_eq(1, umsgpack_trace_get(UMSGPACK_TRACE_DOUBLE_COMPACT)->count);
+	mu_assert_int_eq(1, umsgpack_trace_get(UMSGPACK_TRACE_DOUBLE_NARROW)->count);
+}
+#endif
+
 MU_TEST_SUITE(test_suite) {
 	judge_system_endian();
 	MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
@@ -770,8 +2974,14 @@ MU_TEST_SUITE(test_suite) {
 	MU_RUN_TEST(test_ext8);
 	MU_RUN_TEST(test_ext16);
 	MU_RUN_TEST(test_ext32);
+	MU_RUN_TEST(test_timestamp);
 	MU_RUN_TEST(test_float32);
 	MU_RUN_TEST(test_float64);
+	MU_RUN_TEST(test_double_compact);
+#if defined(UMSGPACK_TEST_MCF) && defined(UMSGPACK_FUNC_UNPACK)
+	MU_RUN_TEST(test_mcf);
+#endif
+	MU_RUN_TEST(test_fixed_as_float);
 	MU_RUN_TEST(test_uint8);
 	MU_RUN_TEST(test_uint16);
 	MU_RUN_TEST(test_uint32);
@@ -788,11 +2998,71 @@ MU_TEST_SUITE(test_suite) {
 	MU_RUN_TEST(test_str8);
 	MU_RUN_TEST(test_str16);
 	MU_RUN_TEST(test_str32);
+	MU_RUN_TEST(test_reserve);
 	MU_RUN_TEST(test_array16);
 	MU_RUN_TEST(test_array32);
 	MU_RUN_TEST(test_map16);
 	MU_RUN_TEST(test_map32);
 	MU_RUN_TEST(test_negative_fixint);
+#ifdef UMSGPACK_FUNC_UNPACK
+	MU_RUN_TEST(test_unpack_next);
+	MU_RUN_TEST(test_skip);
+	MU_RUN_TEST(test_map_find);
+#endif
+#ifdef UMSGPACK_FUNC_JSON
+	MU_RUN_TEST(test_to_json);
+	MU_RUN_TEST(test_to_json_sink);
+	MU_RUN_TEST(test_pack_json);
+	MU_RUN_TEST(test_json_locale);
+#endif
+#ifdef UMSGPACK_FUNC_DICT
+	MU_RUN_TEST(test_dict);
+#endif
+#ifdef UMSGPACK_FUNC_DELTA
+	MU_RUN_TEST(test_delta);
+#endif
+#ifdef UMSGPACK_FUNC_LOG
+	MU_RUN_TEST(test_log);
+#endif
+#ifdef UMSGPACK_FUNC_PARALLEL
+	MU_RUN_TEST(test_parallel);
+#ifdef UMSGPACK_GROWABLE
+	MU_RUN_TEST(test_parallel_pack);
+#endif
+#ifdef UMSGPACK_FUNC_POOL
+	MU_RUN_TEST(test_tpool);
+#endif
+#endif
+#ifdef UMSGPACK_FUNC_SCHEMA
+	MU_RUN_TEST(test_schema);
+#endif
+#ifdef UMSGPACK_FUNC_DOM
+	MU_RUN_TEST(test_dom);
+#endif
+#ifdef UMSGPACK_FUNC_POOL
+	MU_RUN_TEST(test_pool);
+#endif
+#ifdef UMSGPACK_GROWABLE
+	MU_RUN_TEST(test_growable);
+#endif
+#if defined(UMSGPACK_FUNC_CHAIN) && defined(UMSGPACK_FUNC_POOL)
+	MU_RUN_TEST(test_chain);
+#endif
+#ifdef UMSGPACK_FUNC_TYPED
+	MU_RUN_TEST(test_typed);
+#endif
+#ifdef UMSGPACK_WRAP
+	MU_RUN_TEST(test_wrap);
+#endif
+#ifdef UMSGPACK_FUNC_HASH
+	MU_RUN_TEST(test_hash);
+#endif
+#ifdef UMSGPACK_STATS
+	MU_RUN_TEST(test_stats);
+#endif
+#ifdef UMSGPACK_TRACE
+	MU_RUN_TEST(test_trace);
+#endif
 }
 
 int main(int argc, char *argv[]) {
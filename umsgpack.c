@@ -47,6 +47,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+
+/* Keep the tracing wrappers in umsgpack.h away from the definitions. */
+#define UMSGPACK_INTERNAL
 #include "umsgpack.h"
 
 /*
@@ -99,6 +102,340 @@ static void encode_32bit_value(struct umsgpack_packer_buf *buf, uint32_t val) {
     buf->data[buf->pos++] = p[3];
 }
 
+/*
+ * Encoding statistics (UMSGPACK_STATS)
+ */
+#ifdef UMSGPACK_STATS
+static struct umsgpack_stats stats;
+
+static void stats_packed(const struct umsgpack_packer_buf *buf, unsigned int bytes) {
+    stats.formats[UMSGPACK_STATS_INDEX(buf->data[buf->pos - bytes])]++;
+    stats.bytes += bytes;
+    if (buf->pos > stats.largest)
+        stats.largest = buf->pos;
+}
+
+static void stats_payload(const struct umsgpack_packer_buf *buf, uint32_t length) {
+    stats.bytes += length;
+    if (buf->pos > stats.largest)
+        stats.largest = buf->pos;
+}
+
+#define UMSGPACK_STATS_PACKED(buf, bytes)   stats_packed(buf, bytes)
+#define UMSGPACK_STATS_PAYLOAD(buf, length) stats_payload(buf, length)
+#define UMSGPACK_STATS_OVERFLOW()           (stats.overflows++)
+#else
+#define UMSGPACK_STATS_PACKED(buf, bytes)
+#define UMSGPACK_STATS_PAYLOAD(buf, length)
+#define UMSGPACK_STATS_OVERFLOW()
+#endif
+
+/*
+ * Content hash (UMSGPACK_FUNC_HASH)
+ */
+#ifdef UMSGPACK_FUNC_HASH
+#ifdef UMSGPACK_HASH_FNV
+#define HASH_FNV_BASIS 0x811c9dc5UL
+#define HASH_FNV_PRIME 0x01000193UL
+#else
+#define HASH_P1 0x9E3779B185EBCA87ULL
+#define HASH_P2 0xC2B2AE3D27D4EB4FULL
+#define HASH_P3 0x165667B19E3779F9ULL
+#define HASH_P4 0x85EBCA77C2B2AE63ULL
+#define HASH_P5 0x27D4EB2F165667C5ULL
+
+static uint64_t hash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t hash_read64(const unsigned char *p) {
+    uint64_t v = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t hash_lane(uint64_t acc, uint64_t lane) {
+    lane *= HASH_P2;
+    lane = hash_rotl(lane, 31) * HASH_P1;
+    return hash_rotl(acc ^ lane, 27) * HASH_P1 + HASH_P4;
+}
+#endif
+
+/**
+ * @param[out] h     Hash state
+ * @param[in]  seed  Seed; both ends must use the same one
+ */
+void umsgpack_hash_init(struct umsgpack_hash *h, uint64_t seed) {
+#ifdef UMSGPACK_HASH_FNV
+    h->acc = HASH_FNV_BASIS ^ (uint32_t)seed;
+#else
+    h->acc = seed + HASH_P5;
+    h->length = 0;
+#endif
+}
+
+/**
+ * @param[in,out] h    Hash state
+ * @param[in]     p    Data
+ * @param[in]     len  Length of the data
+ *
+ * Folds in the next bytes. Splitting the data differently across calls
+ * gives the same digest.
+ */
+void umsgpack_hash_update(struct umsgpack_hash *h, const void *p, size_t len) {
+    const unsigned char *s = p;
+#ifdef UMSGPACK_HASH_FNV
+    uint32_t acc = h->acc;
+
+    while (len--)
+        acc = (acc ^ *s++) * HASH_FNV_PRIME;
+    h->acc = acc;
+#else
+    unsigned int fill = (unsigned int)(h->length & 7);
+    uint64_t acc = h->acc;
+
+    h->length += len;
+    if (fill) {
+        unsigned int n = 8 - fill < len ? 8 - fill : (unsigned int)len;
+        memcpy(h->tail + fill, s, n);
+        s += n;
+        len -= n;
+        if (fill + n < 8)
+            return;
+        acc = hash_lane(acc, hash_read64(h->tail));
+    }
+    for (; len >= 8; s += 8, len -= 8)
+        acc = hash_lane(acc, hash_read64(s));
+    memcpy(h->tail, s, len);
+    h->acc = acc;
+#endif
+}
+
+/**
+ * @param[in] h      Hash state
+ *
+ * Returns the hash of everything folded in so far; h can keep going.
+ */
+uint64_t umsgpack_hash_digest(const struct umsgpack_hash *h) {
+#ifdef UMSGPACK_HASH_FNV
+    return h->acc;
+#else
+    unsigned int n = (unsigned int)(h->length & 7), i = 0;
+    uint64_t acc = h->acc + h->length;
+
+    if (n >= 4) {
+        uint32_t v = (uint32_t)h->tail[0] | (uint32_t)h->tail[1] << 8 |
+                     (uint32_t)h->tail[2] << 16 | (uint32_t)h->tail[3] << 24;
+        acc = hash_rotl(acc ^ (v * HASH_P1), 23) * HASH_P2 + HASH_P3;
+        i = 4;
+    }
+    for (; i < n; i++)
+        acc = hash_rotl(acc ^ (h->tail[i] * HASH_P5), 11) * HASH_P1;
+    acc ^= acc >> 33;
+    acc *= HASH_P2;
+    acc ^= acc >> 29;
+    acc *= HASH_P3;
+    acc ^= acc >> 32;
+    return acc;
+#endif
+}
+
+/**
+ * @param[in] p      Data
+ * @param[in] len    Length of the data
+ * @param[in] seed   Seed
+ *
+ * One-shot hash, equal to init + update + digest.
+ */
+uint64_t umsgpack_hash(const void *p, size_t len, uint64_t seed) {
+    struct umsgpack_hash h;
+
+    umsgpack_hash_init(&h, seed);
+    umsgpack_hash_update(&h, p, len);
+    return umsgpack_hash_digest(&h);
+}
+
+/*
+ * Folds the bytes packed since the last fold into the attached hash.
+ * Bytes rewritten after they were folded are not seen again.
+ */
+static void hash_fold(struct umsgpack_packer_buf *buf) {
+    if (buf->pos < buf->hashed)
+        buf->hashed = buf->pos;
+    if (buf->hash)
+        umsgpack_hash_update(buf->hash, &buf->data[buf->hashed], buf->pos - buf->hashed);
+    buf->hashed = buf->pos;
+}
+#endif
+
+/* Bytes left in the current buffer or chunk, whatever umsgpack_size_t is */
+#define buf_room(buf) ((uint32_t)((buf)->length - (buf)->pos))
+
+/*
+ * Sets up a fixed-size buffer whose data follows the struct.
+ */
+static void buf_setup(struct umsgpack_packer_buf *buf, size_t length) {
+    buf->length = length > UMSGPACK_SIZE_MAX ? UMSGPACK_SIZE_MAX : (umsgpack_size_t)length;
+    buf->pos = 0;
+#ifdef UMSGPACK_BUF_POINTER
+    buf->data = (unsigned char *)(buf + 1);
+#endif
+#ifdef UMSGPACK_GROWABLE
+    buf->realloc = NULL;
+    buf->ctx = NULL;
+#endif
+#ifdef UMSGPACK_FUNC_CHAIN
+    buf->chain = NULL;
+#endif
+#ifdef UMSGPACK_FUNC_HASH
+    buf->hash = NULL;
+    buf->hashed = 0;
+#endif
+}
+
+#ifdef UMSGPACK_GROWABLE
+/*
+ * Grows a buffer to at least `needed' bytes, doubling its size so a
+ * message costs O(log n) reallocations.
+ */
+static int grow(struct umsgpack_packer_buf *buf, uint64_t needed) {
+    uint64_t length = buf->length < 32 ? 64 : (uint64_t)buf->length * 2;
+    unsigned char *data;
+
+    if (!buf->realloc || needed > UMSGPACK_SIZE_MAX)
+        return 0;
+    if (length < needed)
+        length = needed;
+    if (length > UMSGPACK_SIZE_MAX)
+        length = UMSGPACK_SIZE_MAX;
+    data = buf->realloc(buf->ctx, buf->data, (size_t)length);
+    if (!data)
+        return 0;
+    buf->data = data;
+    buf->length = (umsgpack_size_t)length;
+    return 1;
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_CHAIN
+static struct umsgpack_chunk *chain_take(struct umsgpack_chain *chain) {
+    struct umsgpack_chunk *c = chain->spare;
+
+    if (c)
+        chain->spare = c->next;
+    else
+        c = chain->allocator.alloc(chain->allocator.ctx,
+                                   sizeof(struct umsgpack_chunk) + chain->chunk_size);
+    if (c) {
+        c->next = NULL;
+        c->used = 0;
+    }
+    return c;
+}
+
+/*
+ * Closes the chunk being written and continues in a fresh one, if
+ * `bytes' fit in a chunk at all.
+ */
+static int chain_next(struct umsgpack_packer_buf *buf, uint32_t bytes) {
+    struct umsgpack_chain *chain = buf->chain;
+    struct umsgpack_chunk *c;
+
+    if (!chain || bytes > chain->chunk_size || !(c = chain_take(chain)))
+        return 0;
+#ifdef UMSGPACK_FUNC_HASH
+    hash_fold(buf);
+    buf->hashed = 0;
+#endif
+    chain->tail->used = buf->pos;
+    chain->closed += buf->pos;
+    chain->tail->next = c;
+    chain->tail = c;
+    buf->data = c->data;
+    buf->length = chain->chunk_size;
+    buf->pos = 0;
+    return 1;
+}
+
+/*
+ * Makes sure a `header' byte format header followed by a `payload' byte
+ * payload can be written, which may span several chunks. The chunks are
+ * set aside first so that a pack either fits entirely or fails untouched.
+ */
+static int chain_reserve(struct umsgpack_packer_buf *buf, uint32_t header, uint32_t payload) {
+    struct umsgpack_chain *chain = buf->chain;
+    uint32_t room = buf_room(buf);
+    uint64_t needed = 0;
+    struct umsgpack_chunk *c;
+
+    if (!header)
+        return 0;
+    if (header > room) {
+        needed++;
+        room = chain->chunk_size;
+    }
+    room -= header;
+    if (payload > room)
+        needed += (payload - room + chain->chunk_size - 1) / chain->chunk_size;
+
+    for (c = chain->spare; c && needed; c = c->next)
+        needed--;
+    while (needed--) {
+        c = chain->allocator.alloc(chain->allocator.ctx,
+                                   sizeof(struct umsgpack_chunk) + chain->chunk_size);
+        if (!c) {
+            UMSGPACK_STATS_OVERFLOW();
+            return 0;
+        }
+        c->next = chain->spare;
+        chain->spare = c;
+    }
+    return header <= buf_room(buf) || chain_next(buf, header);
+}
+#endif
+
+/*
+ * Returns 1 if the buffer can take another `bytes' bytes, growing it or
+ * moving on to the next chunk first if it can.
+ */
+static int has_room(struct umsgpack_packer_buf *buf, uint32_t bytes) {
+    if (bytes > buf_room(buf)) {
+#ifdef UMSGPACK_GROWABLE
+        if (grow(buf, (uint64_t)buf->pos + bytes))
+            return 1;
+#endif
+#ifdef UMSGPACK_FUNC_CHAIN
+        if (chain_next(buf, bytes))
+            return 1;
+#endif
+        UMSGPACK_STATS_OVERFLOW();
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Copies a str payload whose room was checked with has_room(), or with
+ * chain_reserve() on a chained buffer.
+ */
+static void put_payload(struct umsgpack_packer_buf *buf, const void *s, uint32_t length) {
+#ifdef UMSGPACK_FUNC_CHAIN
+    while (buf->chain && length > buf_room(buf)) {
+        uint32_t n = buf_room(buf);
+        memcpy(&buf->data[buf->pos], s, n);
+        buf->pos += n;
+        s = (const unsigned char *)s + n;
+        length -= n;
+        chain_next(buf, 0);
+    }
+#endif
+    memcpy(&buf->data[buf->pos], s, length);
+    buf->pos += length;
+}
+
 #ifdef UMSGPACK_FUNC_INT64
 static void encode_64bit_value(struct umsgpack_packer_buf *buf, uint64_t val) {
     uint64_t be = _bswap_64(val);
@@ -120,9 +457,10 @@ static void encode_64bit_value(struct umsgpack_packer_buf *buf, uint64_t val) {
  */
 int umsgpack_pack_array(struct umsgpack_packer_buf *buf, int length) {
     int bytes;
-    bytes = length > 0x0f ? 3: 1;
+    bytes = length <= 0x0f ? 1:
+            (unsigned int)length <= 0xFFFF ? 3: 5;
 
-    if (buf->pos + bytes > buf->length)
+    if (!has_room(buf, bytes))
         return 0;
 
     switch (bytes) {
@@ -135,9 +473,15 @@ int umsgpack_pack_array(struct umsgpack_packer_buf *buf, int length) {
         encode_16bit_value(buf, (uint16_t)length);
         break;
 
+    case 5:
+        buf->data[buf->pos++] = 0xdd;
+        encode_32bit_value(buf, (uint32_t)length);
+        break;
+
     default:
         break;
     }
+    UMSGPACK_STATS_PACKED(buf, bytes);
     return 1;
 }
 
@@ -155,7 +499,7 @@ int umsgpack_pack_uint16(struct umsgpack_packer_buf *buf, uint16_t val) {
     bytes = (val <= 0x7f) ? 1:
             (val <= 0xff) ? 2: 3;
 
-    if (buf->pos + bytes > buf->length) {
+    if (!has_room(buf, bytes)) {
         return 0;
     }
 
@@ -177,6 +521,7 @@ int umsgpack_pack_uint16(struct umsgpack_packer_buf *buf, uint16_t val) {
     default:
         break;
     }
+    UMSGPACK_STATS_PACKED(buf, bytes);
     return 1;
 }
 
@@ -191,7 +536,7 @@ int umsgpack_pack_int16(struct umsgpack_packer_buf *buf, int16_t val) {
     bytes = (val >= -32) ? 1 :
             (val >= -128) ? 2 : 3;
 
-    if (buf->pos + bytes > buf->length)
+    if (!has_room(buf, bytes))
         return 0;
 
     switch (bytes) {
@@ -212,6 +557,7 @@ int umsgpack_pack_int16(struct umsgpack_packer_buf *buf, int16_t val) {
     default:
         break;
     }
+    UMSGPACK_STATS_PACKED(buf, bytes);
     return 1;
 }
 #endif
@@ -225,11 +571,12 @@ int umsgpack_pack_uint32(struct umsgpack_packer_buf *buf, uint32_t val) {
     if (val < 0x10000)
         return umsgpack_pack_uint16(buf, val);
 
-    if (buf->pos + bytes > buf->length)
+    if (!has_room(buf, bytes))
         return 0;
 
     buf->data[buf->pos++] = 0xce;
     encode_32bit_value(buf, val);
+    UMSGPACK_STATS_PACKED(buf, bytes);
     return 1;
 }
 
@@ -242,11 +589,12 @@ int umsgpack_pack_int32(struct umsgpack_packer_buf *buf, int32_t val) {
     if (val >= (int32_t) -32768)
         return umsgpack_pack_int16(buf, (int16_t) val);
 
-    if (buf->pos + bytes > buf->length)
+    if (!has_room(buf, bytes))
         return 0;
 
     buf->data[buf->pos++] = 0xd2;
     encode_32bit_value(buf, (uint32_t)val);
+    UMSGPACK_STATS_PACKED(buf, bytes);
     return 1;
 }
 #endif
@@ -263,11 +611,12 @@ int umsgpack_pack_uint64(struct umsgpack_packer_buf *buf, uint64_t val) {
     if (val <= (uint64_t) 0xFFFFFFFF)
         return umsgpack_pack_uint32(buf, (uint32_t) val);
 
-    if (buf->pos + bytes > buf->length)
+    if (!has_room(buf, bytes))
         return 0;
 
     buf->data[buf->pos++] = 0xcf;
     encode_64bit_value(buf, val);
+    UMSGPACK_STATS_PACKED(buf, bytes);
     return 1;
 }
 
@@ -283,11 +632,12 @@ int umsgpack_pack_int64(struct umsgpack_packer_buf *buf, int64_t val) {
         return umsgpack_pack_int32(buf, (int32_t) val);
 #endif
 
-    if (buf->pos + bytes > buf->length)
+    if (!has_room(buf, bytes))
         return 0;
 
     buf->data[buf->pos++] = 0xd3;
     encode_64bit_value(buf, (uint64_t)val);
+    UMSGPACK_STATS_PACKED(buf, bytes);
     return 1;
 }
 
@@ -313,64 +663,224 @@ int umsgpack_pack_uint(struct umsgpack_packer_buf *buf, unsigned int val) {
 #endif
 }
 
+/*
+ * Packs float32 from its IEEE 754 bit pattern.
+ */
+static int pack_float_bits(struct umsgpack_packer_buf *buf, uint32_t bits) {
+    int bytes = 5;
+
+    if (!has_room(buf, bytes))
+        return 0;
+    buf->data[buf->pos++] = 0xca;
+    encode_32bit_value(buf, bits);
+    UMSGPACK_STATS_PACKED(buf, bytes);
+    return 1;
+}
+
+#if UMSGPACK_HW_FLOAT_MCF || defined(UMSGPACK_TEST_MCF)
+/*
+ * Microchip float (eeeeeeee s mmm...) to IEEE 754 (s eeeeeeee mmm...).
+ * Both use bias 127 and a hidden bit, so only the sign moves. MCF zero
+ * (exponent 0) may carry mantissa bits, which are cleared; the top MCF
+ * binade has no IEEE counterpart and saturates to infinity.
+ */
+static uint32_t mcf_to_ieee(uint32_t m) {
+    uint32_t exp = m >> 24;
+    uint32_t mant = m & 0x7fffffUL;
+
+    mant &= 0 - (uint32_t)(exp != 0 && exp != 0xff);
+    return (m & 0x800000UL) << 8 | exp << 23 | mant;
+}
+#endif
+
+#ifdef UMSGPACK_TEST_MCF
+uint32_t umsgpack_test_mcf_to_ieee(uint32_t m) {
+    return mcf_to_ieee(m);
+}
+#endif
+
 /**
  * @param[in] buf    Destination buffer
  * @param[in] val    Value to be packed
  */
 int umsgpack_pack_float(struct umsgpack_packer_buf *buf, float val) {
-    int bytes = 5;
+#if UMSGPACK_HW_FLOAT_IEEE754COMPLIANT
+    uint32_t bits;
+
+    memcpy(&bits, &val, sizeof(bits));
+    return pack_float_bits(buf, bits);
+#elif UMSGPACK_HW_FLOAT_MCF
+    uint32_t bits;
+
+    memcpy(&bits, &val, sizeof(bits));
+    return pack_float_bits(buf, mcf_to_ieee(bits));
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @param[in] buf        Destination buffer
+ * @param[in] raw        Fixed-point value, e.g. Q8.8 or Q16.16
+ * @param[in] frac_bits  Number of fractional bits in raw (0-31)
+ *
+ * Packs raw / 2^frac_bits as float32, building the bit pattern with
+ * integer operations so no soft-float code is linked in. Values with
+ * more than 24 significant bits are rounded to nearest even.
+ */
+int umsgpack_pack_fixed_as_float(struct umsgpack_packer_buf *buf, int32_t raw, int frac_bits) {
+    uint32_t mag, bits;
+    int msb = 0;
 
-    if (buf->pos + bytes > buf->length) {
+    if (frac_bits < 0 || frac_bits > 31)
         return 0;
+    if (!raw)
+        return pack_float_bits(buf, 0);
+
+    bits = raw < 0 ? 0x80000000UL : 0;
+    mag = raw < 0 ? 0 - (uint32_t)raw : (uint32_t)raw;
+    /* index of the leading one bit */
+    if (mag >> 16) { mag >>= 16; msb += 16; }
+    if (mag >> 8) { mag >>= 8; msb += 8; }
+    if (mag >> 4) { mag >>= 4; msb += 4; }
+    if (mag >> 2) { mag >>= 2; msb += 2; }
+    if (mag >> 1) msb += 1;
+    mag = raw < 0 ? 0 - (uint32_t)raw : (uint32_t)raw;
+
+    if (msb > 23) {
+        int shift = msb - 23;
+        uint32_t rest = mag & ((1UL << shift) - 1), half = 1UL << (shift - 1);
+
+        mag >>= shift;
+        if (rest > half || (rest == half && (mag & 1)))
+            mag++;
+        if (mag >> 24) {
+            mag >>= 1;
+            msb++;
+        }
+    } else {
+        mag <<= 23 - msb;
     }
-    
-#if UMSGPACK_HW_FLOAT_IEEE754COMPLIANT && UMSGPACK_HW_BIG_ENDIAN
-    unsigned char *f = (void*) &val;
-    buf->data[buf->pos++] = 0xca;
-    buf->data[buf->pos++] = *(f + 0);
-    buf->data[buf->pos++] = *(f + 1);
-    buf->data[buf->pos++] = *(f + 2);
-    buf->data[buf->pos++] = *(f + 3);
-#if 0
-    long *f = &val;
-    buf->data[buf->pos++] = 0xca;
-    buf->data[buf->pos++] = *f >> 24;
-    buf->data[buf->pos++] = *f >> 16;
-    buf->data[buf->pos++] = *f >> 8;
-    buf->data[buf->pos++] = *f;
-    return 1;
-#endif
+    bits |= (uint32_t)(msb - frac_bits + 127) << 23 | (mag & 0x7fffffUL);
+    return pack_float_bits(buf, bits);
+}
+
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] val    Value to be packed
+ *
+ * Packs float64. Where double is only 32 bits wide (avr-gcc, C18) it is
+ * packed as float32, which holds it exactly.
+ */
+int umsgpack_pack_double(struct umsgpack_packer_buf *buf, double val) {
+#if UMSGPACK_HW_FLOAT_IEEE754COMPLIANT || UMSGPACK_HW_FLOAT_MCF
+    if (sizeof(double) == sizeof(float))
+        return umsgpack_pack_float(buf, (float)val);
 #endif
-#if UMSGPACK_HW_FLOAT_IEEE754COMPLIANT && UMSGPACK_HW_LITTLE_ENDIAN
-    unsigned char *f = (void*)&val;
-    buf->data[buf->pos++] = 0xca;
-    buf->data[buf->pos++] = *(f + 3);
-    buf->data[buf->pos++] = *(f + 2);
-    buf->data[buf->pos++] = *(f + 1);
-    buf->data[buf->pos++] = *(f + 0);
-    return 1;
+#if UMSGPACK_HW_FLOAT_IEEE754COMPLIANT && defined(UMSGPACK_FUNC_INT64)
+    {
+        int bytes = 9;
+        uint64_t bits;
+
+        if (!has_room(buf, bytes))
+            return 0;
+        memcpy(&bits, &val, sizeof(val));
+        buf->data[buf->pos++] = 0xcb;
+        encode_64bit_value(buf, bits);
+        UMSGPACK_STATS_PACKED(buf, bytes);
+        return 1;
+    }
 #endif
     return 0;
 }
 
+#ifdef UMSGPACK_FUNC_INT64
 /**
  * @param[in] buf    Destination buffer
  * @param[in] val    Value to be packed
+ *
+ * Packs val as float32 if that holds it exactly, else as float64. Like
+ * umsgpack_pack_double_compact() it decides on the bit pattern, so values
+ * outside the float range never go through a float conversion.
  */
-#if 0
-int umsgpack_pack_double(struct umsgpack_packer_buf *buf, double val) {
-    int bytes = 9;
+int umsgpack_pack_double_narrow(struct umsgpack_packer_buf *buf, double val) {
+#if UMSGPACK_HW_FLOAT_IEEE754COMPLIANT
+    uint64_t bits, mant;
+    int exp, negative;
+
+    if (sizeof(double) == sizeof(float))
+        return umsgpack_pack_float(buf, (float)val);
+
+    memcpy(&bits, &val, sizeof(val));
+    negative = (int)(bits >> 63);
+    exp = (int)((bits >> 52) & 0x7ff) - 1023;
+    mant = bits & (((uint64_t)1 << 52) - 1);
+
+    /* float32: normal range with the low 29 mantissa bits clear */
+    if (exp >= -126 && exp <= 127 && !(mant & 0x1fffffff))
+        return pack_float_bits(buf, (uint32_t)negative << 31 | (uint32_t)(exp + 127) << 23 |
+                                    (uint32_t)(mant >> 29));
+    /* float32 subnormals */
+    if (exp >= -149 && exp < -126) {
+        uint64_t full = mant | (uint64_t)1 << 52;
+        int shift = -exp - 97;
+        if (!(full & (((uint64_t)1 << shift) - 1)))
+            return pack_float_bits(buf, (uint32_t)negative << 31 | (uint32_t)(full >> shift));
+    }
+    /* -0.0, infinities and NaNs whose payload fits */
+    if ((exp == -1023 && !mant) || (exp == 1024 && !(mant & 0x1fffffff)))
+        return pack_float_bits(buf, (uint32_t)negative << 31 | (exp == 1024 ? 0xffUL << 23 : 0) |
+                                    (uint32_t)(mant >> 29));
+    return umsgpack_pack_double(buf, val);
+#else
+    return umsgpack_pack_double(buf, val);
+#endif
+}
+#endif
 
-    if (buf->pos + bytes > buf->length) {
-        return 0;
+#if defined(UMSGPACK_FUNC_INT64) && defined(UMSGPACK_FUNC_INT32)
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] val    Value to be packed
+ *
+ * Packs val in the smallest form that decodes to exactly the same value:
+ * an integer if it is integral and fits int64/uint64, else float32 if it
+ * survives the narrowing, else float64. -0.0 stays a float. The tests
+ * look at the bit pattern only, so no floating point code is pulled in
+ * on soft-float targets.
+ */
+int umsgpack_pack_double_compact(struct umsgpack_packer_buf *buf, double val) {
+#if UMSGPACK_HW_FLOAT_IEEE754COMPLIANT
+    uint64_t bits, mant;
+    int exp, negative;
+
+    if (sizeof(double) == sizeof(float))
+        return umsgpack_pack_float(buf, (float)val);
+
+    memcpy(&bits, &val, sizeof(val));
+    negative = (int)(bits >> 63);
+    exp = (int)((bits >> 52) & 0x7ff) - 1023;
+    mant = bits & (((uint64_t)1 << 52) - 1);
+
+    /* integers: +0 and normal values with no fraction bits */
+    if (!bits)
+        return umsgpack_pack_uint(buf, 0);
+    if (exp >= 0 && exp < 64 && (exp >= 52 || !(mant & (((uint64_t)1 << (52 - exp)) - 1)))) {
+        uint64_t full = mant | (uint64_t)1 << 52;
+        uint64_t mag = exp >= 52 ? full << (exp - 52) : full >> (52 - exp);
+
+        if (!negative)
+            return umsgpack_pack_uint64(buf, mag);
+        if (mag <= 0x80000000UL)
+            return umsgpack_pack_int32(buf, (int32_t)(0 - mag));
+        if (mag <= (uint64_t)1 << 63)
+            return umsgpack_pack_int64(buf, (int64_t)(0 - mag));
     }
 
-    buf->data[buf->pos++] = 0xcb;
-    /* FIXME */
-    *((unsigned long*) &buf->data[buf->pos]) = _bswap_32(*((unsigned long*)&val));
-    buf->pos += 8;
+    return umsgpack_pack_double_narrow(buf, val);
+#else
     return 0;
-    return 1;
+#endif
 }
 #endif
 
@@ -384,7 +894,7 @@ int umsgpack_pack_map(struct umsgpack_packer_buf *buf, uint32_t num_objects) {
             num_objects <= 0xFFFF ? 3:
             num_objects <= 0xFFFFFFFF ? 5: 0;
 
-    if (buf->pos + bytes > buf->length)
+    if (!has_room(buf, bytes))
         return 0;
 
     switch (bytes) {
@@ -406,6 +916,51 @@ int umsgpack_pack_map(struct umsgpack_packer_buf *buf, uint32_t num_objects) {
         return 0;
     }
 
+    UMSGPACK_STATS_PACKED(buf, bytes);
+    return 1;
+}
+
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] pos    Position of a fixarray/fixmap header packed earlier
+ * @param[in] count  Number of elements (key-value pairs for a map)
+ *
+ * Sets the count of a container packed before its size was known, with
+ * umsgpack_pack_array(buf, 0) or umsgpack_pack_map(buf, 0). Counts over
+ * 15 need a wider header: what follows is moved up, growing the buffer
+ * if needed. Statistics then show the final header in place of the
+ * placeholder. Chained buffers are refused.
+ */
+int umsgpack_patch_container(struct umsgpack_packer_buf *buf, umsgpack_size_t pos, uint32_t count) {
+    umsgpack_size_t end = buf->pos;
+    int is_map = (buf->data[pos] & 0xf0) == 0x80;
+    uint32_t extra;
+
+    if (count <= 0x0f) {
+        buf->data[pos] = (is_map ? 0x80 : 0x90) | count;
+        return 1;
+    }
+#ifdef UMSGPACK_FUNC_CHAIN
+    if (buf->chain)
+        return 0;
+#endif
+    extra = count <= 0xFFFF ? 2 : 4;
+    /* grows a growable buffer; data may move, positions stay */
+    if (!has_room(buf, extra))
+        return 0;
+    memmove(&buf->data[pos + 1 + extra], &buf->data[pos + 1], end - pos - 1);
+#ifdef UMSGPACK_STATS
+    stats.formats[UMSGPACK_STATS_INDEX(buf->data[pos])]--;
+    stats.bytes--;
+#endif
+
+    buf->pos = pos;
+    if (is_map)
+        umsgpack_pack_map(buf, count);
+    else
+        umsgpack_pack_array(buf, (int)count);
+    buf->pos = end + extra;
+    UMSGPACK_STATS_PAYLOAD(buf, 0);
     return 1;
 }
 
@@ -422,7 +977,13 @@ int umsgpack_pack_str(struct umsgpack_packer_buf *buf, const char *s, uint32_t l
             length <= 0xFF ? 2:
             length <= 0xFFFF ? 3: 0;
 
-    if (buf->pos + bytes + length > buf->length)
+#ifdef UMSGPACK_FUNC_CHAIN
+    if (buf->chain && s) {
+        if (!chain_reserve(buf, bytes, length))
+            return 0;
+    } else
+#endif
+    if (!has_room(buf, bytes + length))
         return 0;
 
     switch (bytes) {
@@ -443,68 +1004,2023 @@ int umsgpack_pack_str(struct umsgpack_packer_buf *buf, const char *s, uint32_t l
     default:
         return 0;
     }
+    UMSGPACK_STATS_PACKED(buf, bytes);
 
     if (s) {
-        memcpy(&buf->data[buf->pos], (void*)s, length);
-        buf->pos += length;
+        put_payload(buf, s, length);
+        UMSGPACK_STATS_PAYLOAD(buf, length);
     }
     return 1;
 }
 
 /**
  * @param[in] buf    Destination buffer
- * @param[in] val    Boolean value (0 == FALSE, Otherwise TRUE)
+ * @param[in] length Number of bytes
+ *
+ * Sets aside `length' bytes for already encoded MessagePack that the
+ * caller writes itself. Returns where to write, or NULL if it does not
+ * fit. The pointer stays valid until the next call that may grow the
+ * buffer.
  */
-int umsgpack_pack_bool(struct umsgpack_packer_buf *buf, int val) {
-    int bytes = 1;
+unsigned char *umsgpack_reserve(struct umsgpack_packer_buf *buf, uint32_t length) {
+    unsigned char *p;
+
+    if (!has_room(buf, length))
+        return NULL;
+    p = &buf->data[buf->pos];
+    buf->pos += length;
+    UMSGPACK_STATS_PAYLOAD(buf, length);
+    return p;
+}
+
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] length Length of the string
+ *
+ * Packs a str header and sets aside `length' bytes after it. Returns
+ * where the caller writes the string, or NULL if it does not fit. The
+ * pointer stays valid until the next call that may grow the buffer.
+ */
+unsigned char *umsgpack_reserve_str(struct umsgpack_packer_buf *buf, uint32_t length) {
+    unsigned char *p;
+
+    if (!umsgpack_pack_str(buf, NULL, length))
+        return NULL;
+    p = &buf->data[buf->pos];
+    buf->pos += length;
+    UMSGPACK_STATS_PAYLOAD(buf, length);
+    return p;
+}
 
-    if (buf->pos + bytes > buf->length)
+/*
+ * Packs a format header followed by a payload copied from `data', or by
+ * room for it if data is NULL (header only, like umsgpack_pack_str()).
+ */
+static int pack_blob(struct umsgpack_packer_buf *buf, const unsigned char *hdr, unsigned int bytes,
+                     const void *data, uint32_t length) {
+    if (length > UINT32_MAX - bytes)
+        return 0;
+#ifdef UMSGPACK_FUNC_CHAIN
+    if (buf->chain && data) {
+        if (!chain_reserve(buf, bytes, length))
+            return 0;
+    } else
+#endif
+    if (!has_room(buf, bytes + length))
         return 0;
 
-    buf->data[buf->pos++] = val ? 0xc3: 0xc2;
+    memcpy(&buf->data[buf->pos], hdr, bytes);
+    buf->pos += bytes;
+    UMSGPACK_STATS_PACKED(buf, bytes);
+    if (data) {
+        put_payload(buf, data, length);
+        UMSGPACK_STATS_PAYLOAD(buf, length);
+    }
     return 1;
 }
 
+static unsigned int bin_header(unsigned char *hdr, uint32_t length) {
+    if (length <= 0xff) {
+        hdr[0] = 0xc4;
+        hdr[1] = length;
+        return 2;
+    }
+    if (length <= 0xffff) {
+        hdr[0] = 0xc5;
+        hdr[1] = length >> 8;
+        hdr[2] = length;
+        return 3;
+    }
+    hdr[0] = 0xc6;
+    hdr[1] = length >> 24;
+    hdr[2] = length >> 16;
+    hdr[3] = length >> 8;
+    hdr[4] = length;
+    return 5;
+}
+
 /**
  * @param[in] buf    Destination buffer
+ * @param[in] length Length of the binary data
+ *
+ * Like umsgpack_reserve_str(), for bin.
  */
-int umsgpack_pack_nil(struct umsgpack_packer_buf *buf) {
-    int bytes = 1;
+unsigned char *umsgpack_reserve_bin(struct umsgpack_packer_buf *buf, uint32_t length) {
+    unsigned char hdr[5];
+    unsigned char *p;
+
+    if (!pack_blob(buf, hdr, bin_header(hdr, length), NULL, length))
+        return NULL;
+    p = &buf->data[buf->pos];
+    buf->pos += length;
+    UMSGPACK_STATS_PAYLOAD(buf, length);
+    return p;
+}
 
-    if (buf->pos + bytes > buf->length)
-        return 0;
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] data   Binary data, or NULL to pack the header only
+ * @param[in] length Length of the data
+ *
+ * Packs bin 8/16/32. If data is NULL only the header is written, and
+ * the caller appends the payload itself, as with umsgpack_pack_str().
+ */
+int umsgpack_pack_bin(struct umsgpack_packer_buf *buf, const void *data, uint32_t length) {
+    unsigned char hdr[5];
 
-    buf->data[buf->pos++] = 0xc0;
-    return 1;
+    return pack_blob(buf, hdr, bin_header(hdr, length), data, length);
 }
 
-void umsgpack_packer_init(struct umsgpack_packer_buf *buf, size_t size) {
-     if (buf) {
-        buf->length = size - sizeof(struct umsgpack_packer_buf);
-        buf->pos = 0;
+static unsigned int ext_header(unsigned char *hdr, int8_t type, uint32_t length) {
+    unsigned int bytes;
+
+    switch (length) {
+    case 1:  hdr[0] = 0xd4; bytes = 1; break;
+    case 2:  hdr[0] = 0xd5; bytes = 1; break;
+    case 4:  hdr[0] = 0xd6; bytes = 1; break;
+    case 8:  hdr[0] = 0xd7; bytes = 1; break;
+    case 16: hdr[0] = 0xd8; bytes = 1; break;
+    default:
+        if (length <= 0xff) {
+            hdr[0] = 0xc7;
+            hdr[1] = length;
+            bytes = 2;
+        } else if (length <= 0xffff) {
+            hdr[0] = 0xc8;
+            hdr[1] = length >> 8;
+            hdr[2] = length;
+            bytes = 3;
+        } else {
+            hdr[0] = 0xc9;
+            hdr[1] = length >> 24;
+            hdr[2] = length >> 16;
+            hdr[3] = length >> 8;
+            hdr[4] = length;
+            bytes = 5;
+        }
+        break;
     }
+    hdr[bytes++] = (uint8_t)type;
+    return bytes;
 }
 
 /**
- * @param[in] size   Size of the buffer to be allocated
+ * @param[in] buf    Destination buffer
+ * @param[in] type   Application-defined type code (negative codes are
+ *                   reserved by the spec)
+ * @param[in] data   Payload, or NULL to pack the header only
+ * @param[in] length Length of the payload
  *
- * In messagepack-lite, the caller is responsible for estimating
- * the buffer size needed.
+ * Packs fixext 1/2/4/8/16 when the length allows, ext 8/16/32 otherwise.
  */
-struct umsgpack_packer_buf *umsgpack_alloc(size_t size) {
-    struct umsgpack_packer_buf *buf = malloc(size + sizeof(struct umsgpack_packer_buf));
-    if (buf) {
-        buf->length = size;
-        buf->pos = 0;
+int umsgpack_pack_ext(struct umsgpack_packer_buf *buf, int8_t type, const void *data, uint32_t length) {
+    unsigned char hdr[6];
+
+    return pack_blob(buf, hdr, ext_header(hdr, type, length), data, length);
+}
+
+/*
+ * Timestamp extension (type -1)
+ */
+#define EXT_TIMESTAMP -1
+
+static void put_be32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] sec    Seconds since the Unix epoch
+ * @param[in] nsec   Nanoseconds, below 1000000000
+ *
+ * Packs timestamp 32 when nsec is 0, timestamp 64 otherwise. Only 32-bit
+ * arithmetic is used; see umsgpack_pack_timestamp64() for dates outside
+ * 1970-2106.
+ */
+int umsgpack_pack_timestamp(struct umsgpack_packer_buf *buf, uint32_t sec, uint32_t nsec) {
+    unsigned char hdr[2] = { 0, (uint8_t)EXT_TIMESTAMP };
+    unsigned char payload[8];
+
+    if (nsec >= 1000000000UL)
+        return 0;
+    if (!nsec) {
+        hdr[0] = 0xd6;
+        put_be32(payload, sec);
+        return pack_blob(buf, hdr, 2, payload, 4);
     }
-    return buf;
+    /* nsec in the upper 30 bits, then 34 bits of seconds */
+    hdr[0] = 0xd7;
+    put_be32(payload, nsec << 2);
+    put_be32(payload + 4, sec);
+    return pack_blob(buf, hdr, 2, payload, 8);
 }
 
+#ifdef UMSGPACK_FUNC_INT64
 /**
- * @param[in] buf    Destination buffer to be freed
+ * @param[in] buf    Destination buffer
+ * @param[in] sec    Seconds since the Unix epoch, may be negative
+ * @param[in] nsec   Nanoseconds, below 1000000000
+ *
+ * Packs the smallest of timestamp 32, 64 and 96 that holds the time.
  */
-int umsgpack_free(struct umsgpack_packer_buf *buf) {
-    free(buf);
-    buf = NULL;
-    return 1;
+int umsgpack_pack_timestamp64(struct umsgpack_packer_buf *buf, int64_t sec, uint32_t nsec) {
+    unsigned char hdr[3] = { 0xc7, 12, (uint8_t)EXT_TIMESTAMP };
+    unsigned char payload[12];
+
+    if (sec >= 0 && (uint64_t)sec <= 0xffffffffUL)
+        return umsgpack_pack_timestamp(buf, (uint32_t)sec, nsec);
+    if (nsec >= 1000000000UL)
+        return 0;
+    if (sec >= 0 && (uint64_t)sec < ((uint64_t)1 << 34)) {
+        hdr[0] = 0xd7;
+        hdr[1] = (uint8_t)EXT_TIMESTAMP;
+        put_be32(payload, nsec << 2 | (uint32_t)(sec >> 32));
+        put_be32(payload + 4, (uint32_t)sec);
+        return pack_blob(buf, hdr, 2, payload, 8);
+    }
+    put_be32(payload, nsec);
+    put_be32(payload + 4, (uint32_t)((uint64_t)sec >> 32));
+    put_be32(payload + 8, (uint32_t)sec);
+    return pack_blob(buf, hdr, 3, payload, 12);
 }
+#endif
+
+#ifdef UMSGPACK_FUNC_TYPED
+static const uint8_t typed_size[] = { 2, 4, 4 };
+
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] kind   UMSGPACK_TYPED_*
+ * @param[in] values Array of int16_t, int32_t or float
+ * @param[in] count  Number of elements
+ *
+ * Packs a whole array as one ext of type UMSGPACK_EXT_TYPED + kind. The
+ * payload is a padding length byte, that many zero bytes and the
+ * elements in little-endian order; the padding puts the elements at an
+ * offset from the start of the buffer that is a multiple of their size,
+ * so a receiver keeping the message aligned can use them in place.
+ */
+int umsgpack_pack_typed(struct umsgpack_packer_buf *buf, uint8_t kind, const void *values, uint32_t count) {
+    unsigned char hdr[6 + 1 + 7];
+    unsigned int size, bytes = 0, pad;
+    uint32_t length;
+    size_t offset;
+
+    if (kind > UMSGPACK_TYPED_FLOAT32 || count > (UINT32_MAX - 8) / 4)
+        return 0;
+#if !UMSGPACK_HW_FLOAT_IEEE754COMPLIANT
+    if (kind == UMSGPACK_TYPED_FLOAT32)
+        return 0;
+#endif
+    size = typed_size[kind];
+
+    /*
+     * The header size depends on the payload length, which depends on the
+     * padding. Alignment is relative to the start of the output: on a
+     * chained buffer that is the chunks closed so far plus pos, which
+     * stays the same if the header moves on to a fresh chunk. Up to
+     * 2 * size - 1 pad bytes are tried since a pad can turn the header
+     * into a shorter fixext.
+     */
+    offset = buf->pos;
+#ifdef UMSGPACK_FUNC_CHAIN
+    if (buf->chain)
+        offset += buf->chain->closed;
+#endif
+    for (pad = 0; pad < 2 * size; pad++) {
+        length = 1 + pad + count * size;
+        bytes = ext_header(hdr, UMSGPACK_EXT_TYPED + kind, length);
+        if ((offset + bytes + 1 + pad) % size == 0)
+            break;
+    }
+    if (pad == 2 * size) {
+        pad = 0;
+        length = 1 + count * size;
+        bytes = ext_header(hdr, UMSGPACK_EXT_TYPED + kind, length);
+    }
+    hdr[bytes++] = pad;
+    memset(&hdr[bytes], 0, pad);
+    bytes += pad;
+
+#ifdef UMSGPACK_LITTLE_ENDIAN
+    return pack_blob(buf, hdr, bytes, values, count * size);
+#else
+    if (!pack_blob(buf, hdr, bytes, NULL, count * size))
+        return 0;
+    {
+        const unsigned char *src = values;
+        uint32_t i;
+        unsigned int j;
+
+        for (i = 0; i < count; i++, src += size)
+            for (j = 0; j < size; j++)
+                buf->data[buf->pos++] = src[size - 1 - j];
+    }
+    UMSGPACK_STATS_PAYLOAD(buf, count * size);
+    return 1;
+#endif
+}
+#endif /* UMSGPACK_FUNC_TYPED */
+
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] val    Boolean value (0 == FALSE, Otherwise TRUE)
+ */
+int umsgpack_pack_bool(struct umsgpack_packer_buf *buf, int val) {
+    int bytes = 1;
+
+    if (!has_room(buf, bytes))
+        return 0;
+
+    buf->data[buf->pos++] = val ? 0xc3: 0xc2;
+    UMSGPACK_STATS_PACKED(buf, bytes);
+    return 1;
+}
+
+/**
+ * @param[in] buf    Destination buffer
+ */
+int umsgpack_pack_nil(struct umsgpack_packer_buf *buf) {
+    int bytes = 1;
+
+    if (!has_room(buf, bytes))
+        return 0;
+
+    buf->data[buf->pos++] = 0xc0;
+    UMSGPACK_STATS_PACKED(buf, bytes);
+    return 1;
+}
+
+void umsgpack_packer_init(struct umsgpack_packer_buf *buf, size_t size) {
+     if (buf) {
+        buf_setup(buf, size - sizeof(struct umsgpack_packer_buf));
+    }
+}
+
+#ifdef UMSGPACK_BUF_POINTER
+/**
+ * @param[out] buf     Packer state
+ * @param[in]  mem     Caller's buffer (stack, static, DMA memory...)
+ * @param[in]  size    Size of mem; capped at UMSGPACK_SIZE_MAX
+ *
+ * Packs into mem, which stays separate from the packer state.
+ */
+void umsgpack_packer_wrap(struct umsgpack_packer_buf *buf, void *mem, size_t size) {
+    if (buf) {
+        buf_setup(buf, size);
+        buf->data = mem;
+    }
+}
+#endif
+
+#ifdef UMSGPACK_FUNC_HASH
+/**
+ * @param[in,out] buf  Packer
+ * @param[in]     h    Hash state from umsgpack_hash_init(), NULL to detach
+ *
+ * Hashes everything packed into buf from now on into h.
+ */
+void umsgpack_packer_hash(struct umsgpack_packer_buf *buf, struct umsgpack_hash *h) {
+    buf->hash = h;
+    buf->hashed = buf->pos;
+}
+
+/**
+ * @param[in,out] buf  Packer with a hash attached
+ *
+ * Returns the hash of the bytes packed since umsgpack_packer_hash().
+ * Packing may go on afterwards.
+ */
+uint64_t umsgpack_packer_digest(struct umsgpack_packer_buf *buf) {
+    if (!buf->hash)
+        return 0;
+    hash_fold(buf);
+    return umsgpack_hash_digest(buf->hash);
+}
+#endif
+
+#ifdef UMSGPACK_GROWABLE
+#ifndef UMSGPACK_NO_MALLOC
+static void *heap_realloc(void *ctx, void *ptr, size_t size) {
+    if (!size) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, size);
+}
+#endif
+
+/**
+ * @param[out] buf     Buffer to set up; the struct itself is the caller's
+ * @param[in]  size    Initial capacity, may be 0
+ * @param[in]  fn      Reallocation function, NULL for realloc()
+ * @param[in]  ctx     Passed to fn
+ */
+int umsgpack_packer_grow_init(struct umsgpack_packer_buf *buf, size_t size,
+                              umsgpack_realloc_fn fn, void *ctx) {
+#ifndef UMSGPACK_NO_MALLOC
+    if (!fn)
+        fn = heap_realloc;
+#endif
+    if (!buf || !fn || size > UMSGPACK_SIZE_MAX)
+        return 0;
+    buf->data = NULL;
+    buf->length = 0;
+    buf->pos = 0;
+    buf->realloc = fn;
+    buf->ctx = ctx;
+#ifdef UMSGPACK_FUNC_CHAIN
+    buf->chain = NULL;
+#endif
+#ifdef UMSGPACK_FUNC_HASH
+    buf->hash = NULL;
+    buf->hashed = 0;
+#endif
+    if (size) {
+        buf->data = fn(ctx, NULL, size);
+        if (!buf->data)
+            return 0;
+        buf->length = (umsgpack_size_t)size;
+    }
+    return 1;
+}
+
+/**
+ * @param[in,out] buf  Growable buffer
+ *
+ * Gives back the capacity beyond the packed data.
+ */
+int umsgpack_packer_shrink(struct umsgpack_packer_buf *buf) {
+    unsigned char *data;
+
+    if (!buf->realloc)
+        return 0;
+    if (buf->pos == buf->length)
+        return 1;
+    if (!buf->pos) {
+        umsgpack_packer_release(buf);
+        return 1;
+    }
+    data = buf->realloc(buf->ctx, buf->data, buf->pos);
+    if (!data)
+        return 0;
+    buf->data = data;
+    buf->length = buf->pos;
+    return 1;
+}
+
+/**
+ * @param[in,out] buf  Growable buffer
+ *
+ * Frees the data. The buffer stays usable and grows again on demand.
+ */
+void umsgpack_packer_release(struct umsgpack_packer_buf *buf) {
+    if (buf->realloc && buf->data)
+        buf->realloc(buf->ctx, buf->data, 0);
+    buf->data = NULL;
+    buf->length = 0;
+    buf->pos = 0;
+}
+#endif /* UMSGPACK_GROWABLE */
+
+#ifdef UMSGPACK_STATS
+/**
+ * @param[out] out   Copy of the counters collected since the last reset
+ *
+ * The counters are plain variables; take the snapshot from the same
+ * context that packs, or with interrupts disabled.
+ */
+void umsgpack_stats_snapshot(struct umsgpack_stats *out) {
+    if (out)
+        memcpy(out, &stats, sizeof(stats));
+}
+
+void umsgpack_stats_reset(void) {
+    memset(&stats, 0, sizeof(stats));
+}
+#endif
+
+#ifdef UMSGPACK_TRACE
+static struct umsgpack_trace_hist trace_hist[UMSGPACK_TRACE_FUNCS];
+static uint32_t trace_start;
+
+void umsgpack_trace_begin(void) {
+    trace_start = umsgpack_trace_cycles();
+}
+
+/**
+ * @param[in] func   Function being traced (UMSGPACK_TRACE_*)
+ * @param[in] ret    Return value of the traced call, passed through
+ */
+int umsgpack_trace_end(int func, int ret) {
+    uint32_t cycles = umsgpack_trace_cycles() - trace_start;
+    struct umsgpack_trace_hist *h = &trace_hist[func];
+    uint32_t v = cycles;
+    int bucket = 0;
+
+    while ((v >>= 1) && bucket < UMSGPACK_TRACE_BUCKETS - 1)
+        bucket++;
+
+    h->count++;
+    h->buckets[bucket]++;
+    if (cycles > h->max)
+        h->max = cycles;
+    return ret;
+}
+
+const struct umsgpack_trace_hist *umsgpack_trace_get(int func) {
+    if (func < 0 || func >= UMSGPACK_TRACE_FUNCS)
+        return NULL;
+    return &trace_hist[func];
+}
+
+/**
+ * @param[in] func     Function being traced (UMSGPACK_TRACE_*)
+ * @param[in] permille Percentile in 1/1000 (500 = p50, 990 = p99)
+ *
+ * Returns the upper bound of the histogram bucket holding the requested
+ * percentile, clamped to the largest observed value.
+ */
+uint32_t umsgpack_trace_percentile(int func, unsigned int permille) {
+    const struct umsgpack_trace_hist *h = umsgpack_trace_get(func);
+    uint32_t target, seen = 0;
+    int i;
+
+    if (!h || !h->count)
+        return 0;
+
+    target = (uint32_t)(((uint64_t)h->count * permille + 999) / 1000);
+    for (i = 0; i < UMSGPACK_TRACE_BUCKETS - 1; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            uint32_t upper = ((uint32_t)2 << i) - 1;
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+void umsgpack_trace_reset(void) {
+    memset(trace_hist, 0, sizeof(trace_hist));
+}
+#endif
+
+#ifndef UMSGPACK_NO_MALLOC
+static void *heap_alloc(void *ctx, size_t size) {
+    return malloc(size);
+}
+
+static void heap_free(void *ctx, void *ptr) {
+    free(ptr);
+}
+
+#define HEAP_ALLOCATOR { heap_alloc, heap_free, NULL }
+#else
+#define HEAP_ALLOCATOR { NULL, NULL, NULL }
+#endif
+
+static struct umsgpack_allocator allocator = HEAP_ALLOCATOR;
+
+/**
+ * @param[in] a      Allocator, or NULL for the default
+ */
+void umsgpack_set_allocator(const struct umsgpack_allocator *a) {
+    static const struct umsgpack_allocator heap = HEAP_ALLOCATOR;
+
+    allocator = a ? *a : heap;
+}
+
+/**
+ * @param[in] size   Size of the buffer to be allocated
+ *
+ * In messagepack-lite, the caller is responsible for estimating
+ * the buffer size needed.
+ */
+struct umsgpack_packer_buf *umsgpack_alloc(size_t size) {
+    struct umsgpack_packer_buf *buf;
+
+    if (!allocator.alloc)
+        return NULL;
+    buf = allocator.alloc(allocator.ctx, size + sizeof(struct umsgpack_packer_buf));
+    if (buf) {
+        buf_setup(buf, size);
+    }
+    return buf;
+}
+
+/**
+ * @param[in] buf    Destination buffer to be freed
+ */
+int umsgpack_free(struct umsgpack_packer_buf *buf) {
+    if (buf && allocator.free)
+        allocator.free(allocator.ctx, buf);
+    buf = NULL;
+    return 1;
+}
+
+#ifdef UMSGPACK_FUNC_POOL
+/**
+ * @param[out] pool      Pool to set up
+ * @param[in]  mem       Memory for the slabs
+ * @param[in]  size      Size of mem in bytes
+ * @param[in]  buf_size  Data bytes of the largest umsgpack_alloc() to serve
+ *
+ * Cuts mem into slabs big enough for a packer buffer of buf_size bytes.
+ * Returns the number of slabs.
+ */
+unsigned int umsgpack_pool_init(struct umsgpack_pool *pool, void *mem, size_t size, size_t buf_size) {
+    const size_t align = sizeof(void *) > sizeof(uint64_t) ? sizeof(void *) : sizeof(uint64_t);
+    unsigned char *p = mem;
+    size_t pad = (align - (uintptr_t)p % align) % align;
+
+    pool->slab_size = (buf_size + sizeof(struct umsgpack_packer_buf) + align - 1) / align * align;
+    pool->free_list = NULL;
+    pool->count = 0;
+    pool->available = 0;
+    if (pad >= size)
+        return 0;
+    p += pad;
+    pool->count = (unsigned int)((size - pad) / pool->slab_size);
+    /* link the slabs back to front so they are handed out in address order */
+    while (pool->available < pool->count) {
+        void **slab = (void **)(p + pool->slab_size * (pool->count - 1 - pool->available));
+        *slab = pool->free_list;
+        pool->free_list = slab;
+        pool->available++;
+    }
+    return pool->count;
+}
+
+/**
+ * @param[in] ctx    Pool
+ * @param[in] size   Bytes wanted, at most the pool's slab size
+ *
+ * Returns a slab, or NULL if the pool is empty or size is too large.
+ */
+void *umsgpack_pool_alloc(void *ctx, size_t size) {
+    struct umsgpack_pool *pool = ctx;
+    void **slab = pool->free_list;
+
+    if (!slab || size > pool->slab_size)
+        return NULL;
+    pool->free_list = *slab;
+    pool->available--;
+    return slab;
+}
+
+/**
+ * @param[in] ctx    Pool
+ * @param[in] ptr    Slab from umsgpack_pool_alloc()
+ */
+void umsgpack_pool_free(void *ctx, void *ptr) {
+    struct umsgpack_pool *pool = ctx;
+
+    *(void **)ptr = pool->free_list;
+    pool->free_list = ptr;
+    pool->available++;
+}
+#endif /* UMSGPACK_FUNC_POOL */
+
+#ifdef UMSGPACK_FUNC_CHAIN
+/**
+ * @param[out] buf        Buffer to set up
+ * @param[out] chain      Chain state, must live as long as buf
+ * @param[in]  a          Allocator for the chunks
+ * @param[in]  chunk_size Data bytes per chunk, at least 16
+ *
+ * Takes the first chunk right away; returns 0 if that fails.
+ */
+int umsgpack_chain_init(struct umsgpack_packer_buf *buf, struct umsgpack_chain *chain,
+                        const struct umsgpack_allocator *a, unsigned int chunk_size) {
+    if (!buf || !chain || !a || !a->alloc || chunk_size < 16 || chunk_size > UMSGPACK_SIZE_MAX)
+        return 0;
+    chain->allocator = *a;
+    chain->chunk_size = chunk_size;
+    chain->spare = NULL;
+    chain->closed = 0;
+    chain->head = chain->tail = chain_take(chain);
+    if (!chain->head)
+        return 0;
+    buf_setup(buf, chunk_size);
+    buf->data = chain->head->data;
+    buf->chain = chain;
+    return 1;
+}
+
+/**
+ * @param[in] buf    Chained buffer
+ *
+ * Returns the number of bytes packed so far.
+ */
+size_t umsgpack_chain_length(const struct umsgpack_packer_buf *buf) {
+    return buf->chain->closed + buf->pos;
+}
+
+/**
+ * @param[in]  buf    Chained buffer
+ * @param[out] segs   Filled with up to `max' segments, in order
+ * @param[in]  max    Size of segs
+ *
+ * Returns the number of non-empty segments the output consists of,
+ * which may be more than max.
+ */
+unsigned int umsgpack_chain_segments(const struct umsgpack_packer_buf *buf,
+                                     struct umsgpack_segment *segs, unsigned int max) {
+    const struct umsgpack_chunk *c;
+    unsigned int n = 0;
+
+    for (c = buf->chain->head; c; c = c->next) {
+        unsigned int used = c == buf->chain->tail ? buf->pos : c->used;
+        if (!used)
+            continue;
+        if (n < max) {
+            segs[n].data = c->data;
+            segs[n].length = used;
+        }
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @param[in,out] buf  Chained buffer
+ *
+ * Empties the buffer for the next message, keeping the first chunk and
+ * releasing the others.
+ */
+void umsgpack_chain_reset(struct umsgpack_packer_buf *buf) {
+    struct umsgpack_chain *chain = buf->chain;
+    struct umsgpack_chunk *c = chain->head->next;
+
+    while (c) {
+        struct umsgpack_chunk *next = c->next;
+        if (chain->allocator.free)
+            chain->allocator.free(chain->allocator.ctx, c);
+        c = next;
+    }
+    chain->head->next = NULL;
+    chain->tail = chain->head;
+    chain->closed = 0;
+    buf->data = chain->head->data;
+    buf->length = chain->chunk_size;
+    buf->pos = 0;
+#ifdef UMSGPACK_FUNC_HASH
+    buf->hashed = 0;
+#endif
+}
+
+/**
+ * @param[in,out] buf  Chained buffer
+ *
+ * Releases every chunk. buf needs umsgpack_chain_init() to be used again.
+ */
+void umsgpack_chain_free(struct umsgpack_packer_buf *buf) {
+    struct umsgpack_chain *chain = buf->chain;
+
+    umsgpack_chain_reset(buf);
+    chain->head->next = chain->spare;
+    chain->spare = NULL;
+    while (chain->head) {
+        struct umsgpack_chunk *next = chain->head->next;
+        if (chain->allocator.free)
+            chain->allocator.free(chain->allocator.ctx, chain->head);
+        chain->head = next;
+    }
+    chain->tail = NULL;
+    buf->chain = NULL;
+    buf->data = NULL;
+    buf->length = 0;
+}
+#endif /* UMSGPACK_FUNC_CHAIN */
+
+/*
+ * Key dictionary
+ */
+#if defined(UMSGPACK_FUNC_DICT) || defined(UMSGPACK_FUNC_SCHEMA)
+
+/*
+ * Minimal perfect hash over NUL-terminated names. Names are read from an
+ * array of records `stride' bytes apart whose first member is the name
+ * pointer, so plain string tables and descriptor tables both work.
+ * table[slot] holds index + 1, 0 marks an empty slot.
+ */
+static uint8_t phash(const char *key, uint32_t length, uint8_t seed, uint8_t slots) {
+    uint16_t h = 5381 + seed;
+
+    while (length--)
+        h = (h << 5) + h + (unsigned char)*key++;
+    return (uint8_t)((h ^ (h >> 8)) % slots);
+}
+
+static const char *phash_name(const void *base, size_t stride, unsigned int i) {
+    return *(const char *const *)((const char *)base + stride * i);
+}
+
+static int phash_build(const void *base, size_t stride, unsigned int count,
+                       uint8_t *table, uint8_t slots, uint8_t *seed) {
+    unsigned int s, i;
+
+    if (count > slots || count > 0xfe)
+        return 0;
+
+    for (s = 0; s <= 0xff; s++) {
+        memset(table, 0, slots);
+        for (i = 0; i < count; i++) {
+            const char *name = phash_name(base, stride, i);
+            uint8_t slot = phash(name, strlen(name), s, slots);
+            if (table[slot])
+                break;
+            table[slot] = i + 1;
+        }
+        if (i == count) {
+            *seed = s;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int phash_find(const void *base, size_t stride, const uint8_t *table, uint8_t slots,
+                      uint8_t seed, const char *key, uint32_t length) {
+    uint8_t i = table[phash(key, length, seed, slots)];
+    const char *name;
+
+    if (!i)
+        return -1;
+    name = phash_name(base, stride, i - 1);
+    /* key comes off the wire and may hold NULs: compare by length */
+    if (strlen(name) != length || memcmp(name, key, length))
+        return -1;
+    return i - 1;
+}
+
+#endif /* UMSGPACK_FUNC_DICT || UMSGPACK_FUNC_SCHEMA */
+
+#ifdef UMSGPACK_FUNC_DICT
+
+/**
+ * @param[out] dict    Dictionary to set up
+ * @param[in]  version Version of the shared key table
+ * @param[in]  keys    Key names; the index is the id sent on the wire
+ * @param[in]  count   Number of keys (up to 128)
+ * @param[in]  table   Storage for the hash table, `slots' bytes
+ * @param[in]  slots   Hash table size, at least count (2 * count works well)
+ *
+ * Searches a seed that maps every key to its own slot. Returns 0 if
+ * there is none for this table size.
+ */
+int umsgpack_dict_init(struct umsgpack_dict *dict, uint8_t version,
+                       const char *const *keys, uint8_t count,
+                       uint8_t *table, uint8_t slots) {
+    if (!dict || count > 128)
+        return 0;
+
+    dict->version = version;
+    dict->count = count;
+    dict->keys = keys;
+    dict->table = table;
+    dict->slots = slots;
+    return phash_build(keys, sizeof(keys[0]), count, table, slots, &dict->seed);
+}
+
+/**
+ * @param[in] dict   Dictionary
+ * @param[in] key    Key name
+ * @param[in] length Length of the key name
+ *
+ * Returns the id of the key, or -1 if it is not in the dictionary.
+ */
+int umsgpack_dict_find(const struct umsgpack_dict *dict, const char *key, uint32_t length) {
+    if (!dict->count)
+        return -1;
+    return phash_find(dict->keys, sizeof(dict->keys[0]), dict->table, dict->slots,
+                      dict->seed, key, length);
+}
+
+/**
+ * @param[in] dict   Dictionary
+ * @param[in] id     Key id as found on the wire
+ *
+ * Returns the key name, or NULL for an unknown id.
+ */
+const char *umsgpack_dict_name(const struct umsgpack_dict *dict, uint32_t id) {
+    if (id >= dict->count)
+        return NULL;
+    return dict->keys[id];
+}
+
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] dict   Dictionary, may be NULL
+ * @param[in] key    Key name
+ * @param[in] length Length of the key name
+ *
+ * Packs a map key as its dictionary id (a positive fixint), or as a
+ * string if it is not in the dictionary.
+ */
+int umsgpack_pack_key(struct umsgpack_packer_buf *buf, const struct umsgpack_dict *dict,
+                      const char *key, uint32_t length) {
+    int id = dict ? umsgpack_dict_find(dict, key, length) : -1;
+
+    if (id >= 0)
+        return umsgpack_pack_uint(buf, id);
+    return umsgpack_pack_str(buf, key, length);
+}
+
+#endif /* UMSGPACK_FUNC_DICT */
+
+/*
+ * Delta records
+ */
+#ifdef UMSGPACK_FUNC_DELTA
+
+#ifndef UMSGPACK_FUNC_INT32
+#error UMSGPACK_FUNC_DELTA requires UMSGPACK_FUNC_INT32
+#endif
+
+/**
+ * @param[out] delta    Stream state
+ * @param[in]  fields   Field descriptions, in record order
+ * @param[in]  values   Storage for the last record, one entry per field
+ * @param[in]  count    Number of fields
+ * @param[in]  keyframe Send every field each `keyframe' records (0: only first)
+ */
+void umsgpack_delta_init(struct umsgpack_delta *delta,
+                         const struct umsgpack_delta_field *fields,
+                         union umsgpack_delta_value *values,
+                         uint8_t count, uint8_t keyframe) {
+    delta->fields = fields;
+    delta->values = values;
+    delta->count = count;
+    delta->keyframe = keyframe;
+    delta->since_keyframe = 0;
+    delta->valid = 0;
+#ifdef UMSGPACK_FUNC_DICT
+    delta->dict = NULL;
+#endif
+}
+
+static int delta_pack_value(struct umsgpack_packer_buf *buf, uint8_t type,
+                            const union umsgpack_delta_value *value) {
+    switch (type) {
+    case UMSGPACK_DELTA_INT:
+        return umsgpack_pack_int32(buf, value->i);
+
+    case UMSGPACK_DELTA_FLOAT:
+        return umsgpack_pack_float(buf, value->f);
+
+    case UMSGPACK_DELTA_BOOL:
+        return umsgpack_pack_bool(buf, value->i);
+
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] delta  Stream state
+ * @param[in] values Current record, one entry per field
+ *
+ * Packs a map holding only the fields that differ from the previous
+ * record, or every field on a keyframe. Nothing is updated if the buffer
+ * is too small, so the call can be retried with a larger one. Chained
+ * buffers are refused: a failed record could not be rolled back across
+ * the chunks it closed.
+ */
+int umsgpack_pack_delta(struct umsgpack_packer_buf *buf, struct umsgpack_delta *delta,
+                        const union umsgpack_delta_value *values) {
+    umsgpack_size_t start = buf->pos;
+    int keyframe = !delta->valid || (delta->keyframe && delta->since_keyframe + 1 >= delta->keyframe);
+    uint8_t changed = 0;
+    uint8_t i;
+
+#ifdef UMSGPACK_FUNC_CHAIN
+    if (buf->chain)
+        return 0;
+#endif
+    for (i = 0; i < delta->count; i++) {
+        if (keyframe || memcmp(&values[i], &delta->values[i], sizeof(values[i])))
+            changed++;
+    }
+
+    if (!umsgpack_pack_map(buf, changed))
+        return 0;
+
+    for (i = 0; i < delta->count; i++) {
+        const struct umsgpack_delta_field *field = &delta->fields[i];
+        uint32_t length;
+
+        if (!keyframe && !memcmp(&values[i], &delta->values[i], sizeof(values[i])))
+            continue;
+
+        length = strlen(field->key);
+#ifdef UMSGPACK_FUNC_DICT
+        if (!umsgpack_pack_key(buf, delta->dict, field->key, length) ||
+#else
+        if (!umsgpack_pack_str(buf, field->key, length) ||
+#endif
+            !delta_pack_value(buf, field->type, &values[i])) {
+            buf->pos = start;
+            return 0;
+        }
+    }
+
+    memcpy(delta->values, values, sizeof(values[0]) * delta->count);
+    delta->valid = 1;
+    delta->since_keyframe = keyframe ? 0 : delta->since_keyframe + 1;
+    return 1;
+}
+
+#ifdef UMSGPACK_FUNC_UNPACK
+static int delta_find_field(const struct umsgpack_delta *delta, const struct umsgpack_obj *key) {
+    const char *name;
+    uint32_t length;
+    uint8_t i;
+
+    if (key->type == UMSGPACK_TYPE_STR) {
+        name = (const char *)key->ptr;
+        length = key->length;
+#ifdef UMSGPACK_FUNC_DICT
+    } else if (key->type == UMSGPACK_TYPE_UINT && delta->dict &&
+               key->v.u < delta->dict->count) {
+        name = umsgpack_dict_name(delta->dict, (uint32_t)key->v.u);
+        length = strlen(name);
+#endif
+    } else {
+        return -1;
+    }
+
+    for (i = 0; i < delta->count; i++) {
+        const char *k = delta->fields[i].key;
+        if (strlen(k) == length && !memcmp(k, name, length))
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @param[in,out] delta  Stream state; values hold the reconstructed record
+ * @param[in]     p      Encoded delta record
+ * @param[in]     len    Number of bytes available at p
+ *
+ * Applies a record produced by umsgpack_pack_delta(). A record carrying
+ * every field is a keyframe and marks the state valid; until then
+ * fields that were never received keep their initial values. Unknown
+ * keys are ignored.
+ *
+ * Returns the number of bytes consumed, or 0 on malformed input.
+ */
+size_t umsgpack_unpack_delta(struct umsgpack_delta *delta, const unsigned char *p, size_t len) {
+    struct umsgpack_obj obj;
+    size_t off;
+    uint32_t entries, i;
+    int field;
+
+    off = umsgpack_unpack_next(p, len, &obj);
+    if (!off || obj.type != UMSGPACK_TYPE_MAP)
+        return 0;
+    entries = obj.length;
+
+    for (i = 0; i < entries; i++) {
+        union umsgpack_delta_value *value;
+        size_t n = umsgpack_unpack_next(p + off, len - off, &obj);
+        if (!n)
+            return 0;
+        off += n;
+        field = delta_find_field(delta, &obj);
+
+        n = umsgpack_unpack_next(p + off, len - off, &obj);
+        if (!n || obj.type == UMSGPACK_TYPE_ARRAY || obj.type == UMSGPACK_TYPE_MAP)
+            return 0;
+        off += n;
+        if (field < 0)
+            continue;
+
+        value = &delta->values[field];
+        switch (delta->fields[field].type) {
+        case UMSGPACK_DELTA_INT:
+            if (obj.type == UMSGPACK_TYPE_UINT ? obj.v.u > INT32_MAX :
+                obj.type != UMSGPACK_TYPE_INT || obj.v.i < INT32_MIN)
+                return 0;
+            value->i = (int32_t)obj.v.i;
+            break;
+
+        case UMSGPACK_DELTA_FLOAT:
+            if (obj.type != UMSGPACK_TYPE_FLOAT32)
+                return 0;
+            value->f = obj.v.f;
+            break;
+
+        case UMSGPACK_DELTA_BOOL:
+            if (obj.type != UMSGPACK_TYPE_BOOL)
+                return 0;
+            value->i = (int32_t)obj.v.u;
+            break;
+
+        default:
+            return 0;
+        }
+    }
+
+    if (entries == delta->count)
+        delta->valid = 1;
+    return off;
+}
+#endif /* UMSGPACK_FUNC_UNPACK */
+
+#endif /* UMSGPACK_FUNC_DELTA */
+
+/*
+ * Unpacker
+ */
+#ifdef UMSGPACK_FUNC_UNPACK
+
+#ifndef UMSGPACK_FUNC_INT64
+#error UMSGPACK_FUNC_UNPACK requires UMSGPACK_FUNC_INT64
+#endif
+
+static inline uint16_t decode_16bit_value(const unsigned char *p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static inline uint32_t decode_32bit_value(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint64_t decode_64bit_value(const unsigned char *p) {
+    return ((uint64_t)decode_32bit_value(p) << 32) | decode_32bit_value(p + 4);
+}
+
+#if UMSGPACK_HW_FLOAT_MCF || defined(UMSGPACK_TEST_MCF)
+/*
+ * IEEE 754 float32 to Microchip float. Subnormals flush to zero and
+ * infinities/NaNs saturate to the largest MCF magnitude.
+ */
+static uint32_t ieee_to_mcf(uint32_t i) {
+    uint32_t exp = (i >> 23) & 0xff;
+    uint32_t mant = i & 0x7fffffUL;
+
+    mant &= 0 - (uint32_t)(exp != 0);
+    mant |= (0 - (uint32_t)(exp == 0xff)) & 0x7fffffUL;
+    return exp << 24 | (i >> 8 & 0x800000UL) | mant;
+}
+#endif
+
+#ifdef UMSGPACK_TEST_MCF
+uint32_t umsgpack_test_ieee_to_mcf(uint32_t i) {
+    return ieee_to_mcf(i);
+}
+#endif
+
+static void unpack_int(struct umsgpack_obj *obj, int64_t val) {
+    if (val >= 0) {
+        obj->type = UMSGPACK_TYPE_UINT;
+        obj->v.u = (uint64_t)val;
+    } else {
+        obj->type = UMSGPACK_TYPE_INT;
+        obj->v.i = val;
+    }
+}
+
+/**
+ * @param[in]  p      Encoded data
+ * @param[in]  len    Number of bytes available at p
+ * @param[out] obj    Decoded object
+ *
+ * Decodes the object at p. Scalars are returned in obj->v; str, bin and
+ * ext payloads are referenced in place through obj->ptr/obj->length;
+ * for arrays and maps only the header is consumed and obj->length holds
+ * the number of elements (key-value pairs for maps) that follow.
+ *
+ * Returns the number of bytes consumed, or 0 if the data is truncated
+ * or not valid MessagePack.
+ */
+size_t umsgpack_unpack_next(const unsigned char *p, size_t len, struct umsgpack_obj *obj) {
+    size_t hdr = 1;
+    unsigned char b;
+    uint32_t bits32;
+    uint64_t bits64;
+
+    if (!len)
+        return 0;
+
+    b = p[0];
+    obj->ptr = NULL;
+    obj->length = 0;
+    obj->ext_type = 0;
+
+    if (b <= 0x7f) {
+        obj->type = UMSGPACK_TYPE_UINT;
+        obj->v.u = b;
+        return 1;
+    }
+    if (b >= 0xe0) {
+        obj->type = UMSGPACK_TYPE_INT;
+        obj->v.i = (int8_t)b;
+        return 1;
+    }
+    if (b <= 0x8f) {
+        obj->type = UMSGPACK_TYPE_MAP;
+        obj->length = b & 0x0f;
+        return 1;
+    }
+    if (b <= 0x9f) {
+        obj->type = UMSGPACK_TYPE_ARRAY;
+        obj->length = b & 0x0f;
+        return 1;
+    }
+    if (b <= 0xbf) {
+        obj->type = UMSGPACK_TYPE_STR;
+        obj->length = b & 0x1f;
+        goto payload;
+    }
+
+    switch (b) {
+    case 0xc0:
+        obj->type = UMSGPACK_TYPE_NIL;
+        return 1;
+
+    case 0xc2:
+    case 0xc3:
+        obj->type = UMSGPACK_TYPE_BOOL;
+        obj->v.u = b & 0x01;
+        return 1;
+
+    case 0xc4: case 0xc5: case 0xc6:
+    case 0xd9: case 0xda: case 0xdb:
+        obj->type = b <= 0xc6 ? UMSGPACK_TYPE_BIN : UMSGPACK_TYPE_STR;
+        hdr = 1 + (1 << ((b <= 0xc6 ? b - 0xc4 : b - 0xd9)));
+        if (len < hdr)
+            return 0;
+        obj->length = hdr == 2 ? p[1] :
+                      hdr == 3 ? decode_16bit_value(p + 1) :
+                                 decode_32bit_value(p + 1);
+        goto payload;
+
+    case 0xc7: case 0xc8: case 0xc9:
+        obj->type = UMSGPACK_TYPE_EXT;
+        hdr = 2 + (1 << (b - 0xc7));
+        if (len < hdr)
+            return 0;
+        obj->length = hdr == 3 ? p[1] :
+                      hdr == 4 ? decode_16bit_value(p + 1) :
+                                 decode_32bit_value(p + 1);
+        obj->ext_type = (int8_t)p[hdr - 1];
+        goto payload;
+
+    case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+        obj->type = UMSGPACK_TYPE_EXT;
+        obj->length = 1 << (b - 0xd4);
+        hdr = 2;
+        if (len < hdr)
+            return 0;
+        obj->ext_type = (int8_t)p[1];
+        goto payload;
+
+    case 0xca:
+        if (len < 5)
+            return 0;
+        bits32 = decode_32bit_value(p + 1);
+        obj->type = UMSGPACK_TYPE_FLOAT32;
+#if UMSGPACK_HW_FLOAT_MCF
+        bits32 = ieee_to_mcf(bits32);
+#endif
+        memcpy(&obj->v.f, &bits32, sizeof(obj->v.f));
+        return 5;
+
+    case 0xcb:
+        if (len < 9)
+            return 0;
+        bits64 = decode_64bit_value(p + 1);
+        obj->type = UMSGPACK_TYPE_FLOAT64;
+        if (sizeof(obj->v.d) == sizeof(bits64))
+            memcpy(&obj->v.d, &bits64, sizeof(bits64));
+        else
+            obj->v.u = bits64;
+        return 9;
+
+    case 0xcc: case 0xcd: case 0xce: case 0xcf:
+        hdr = 1 + (1 << (b - 0xcc));
+        if (len < hdr)
+            return 0;
+        obj->type = UMSGPACK_TYPE_UINT;
+        obj->v.u = hdr == 2 ? p[1] :
+                   hdr == 3 ? decode_16bit_value(p + 1) :
+                   hdr == 5 ? decode_32bit_value(p + 1) :
+                              decode_64bit_value(p + 1);
+        return hdr;
+
+    case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+        hdr = 1 + (1 << (b - 0xd0));
+        if (len < hdr)
+            return 0;
+        unpack_int(obj, hdr == 2 ? (int8_t)p[1] :
+                        hdr == 3 ? (int16_t)decode_16bit_value(p + 1) :
+                        hdr == 5 ? (int32_t)decode_32bit_value(p + 1) :
+                                   (int64_t)decode_64bit_value(p + 1));
+        return hdr;
+
+    case 0xdc: case 0xdd:
+    case 0xde: case 0xdf:
+        obj->type = b <= 0xdd ? UMSGPACK_TYPE_ARRAY : UMSGPACK_TYPE_MAP;
+        hdr = (b & 0x01) ? 5 : 3;
+        if (len < hdr)
+            return 0;
+        obj->length = hdr == 3 ? decode_16bit_value(p + 1) :
+                                 decode_32bit_value(p + 1);
+        return hdr;
+
+    default:
+        /* 0xc1 is never used */
+        return 0;
+    }
+
+payload:
+    if (len - hdr < obj->length)
+        return 0;
+    obj->ptr = p + hdr;
+    return hdr + obj->length;
+}
+
+/*
+ * Structural skip/validate.
+ *
+ * skip_table[] classifies each format byte: objects of fixed size
+ * (scalars, fixstr, fixext), payloads with a 1/2/4 byte length field
+ * (str, bin, ext), and containers. Containers only add to the number of
+ * objects still to be skipped, so nesting needs no recursion or stack.
+ */
+#define SK_INVALID    0x00
+#define SK_FIXED(n)   (0x20 | ((n) - 1))  /* whole object is n bytes */
+#define SK_PAYLOAD(n) (0x40 | (n))        /* n byte length, then payload */
+#define SK_EXT(n)     (0x60 | (n))        /* n byte length, type, payload */
+#define SK_ITEMS(n)   (0x80 | (n))        /* fixarray/fixmap, n objects */
+#define SK_ARRAY(n)   (0xa0 | (n))        /* n byte element count */
+#define SK_MAP(n)     (0xc0 | (n))        /* n byte entry count */
+#define SK_KIND(e)    ((e) >> 5)
+
+static const uint8_t skip_table[256] = {
+    /* 0x00: positive fixint */
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    /* 0x80: fixmap */
+    SK_ITEMS(0), SK_ITEMS(2), SK_ITEMS(4), SK_ITEMS(6), SK_ITEMS(8), SK_ITEMS(10), SK_ITEMS(12), SK_ITEMS(14),
+    SK_ITEMS(16), SK_ITEMS(18), SK_ITEMS(20), SK_ITEMS(22), SK_ITEMS(24), SK_ITEMS(26), SK_ITEMS(28), SK_ITEMS(30),
+    /* 0x90: fixarray */
+    SK_ITEMS(0), SK_ITEMS(1), SK_ITEMS(2), SK_ITEMS(3), SK_ITEMS(4), SK_ITEMS(5), SK_ITEMS(6), SK_ITEMS(7),
+    SK_ITEMS(8), SK_ITEMS(9), SK_ITEMS(10), SK_ITEMS(11), SK_ITEMS(12), SK_ITEMS(13), SK_ITEMS(14), SK_ITEMS(15),
+    /* 0xa0: fixstr */
+    SK_FIXED(1), SK_FIXED(2), SK_FIXED(3), SK_FIXED(4), SK_FIXED(5), SK_FIXED(6), SK_FIXED(7), SK_FIXED(8),
+    SK_FIXED(9), SK_FIXED(10), SK_FIXED(11), SK_FIXED(12), SK_FIXED(13), SK_FIXED(14), SK_FIXED(15), SK_FIXED(16),
+    SK_FIXED(17), SK_FIXED(18), SK_FIXED(19), SK_FIXED(20), SK_FIXED(21), SK_FIXED(22), SK_FIXED(23), SK_FIXED(24),
+    SK_FIXED(25), SK_FIXED(26), SK_FIXED(27), SK_FIXED(28), SK_FIXED(29), SK_FIXED(30), SK_FIXED(31), SK_FIXED(32),
+    /* 0xc0: nil, (never used), bool, bin8-32, ext8-32, float32/64 */
+    SK_FIXED(1), SK_INVALID, SK_FIXED(1), SK_FIXED(1), SK_PAYLOAD(1), SK_PAYLOAD(2), SK_PAYLOAD(4), SK_EXT(1),
+    SK_EXT(2), SK_EXT(4), SK_FIXED(5), SK_FIXED(9), SK_FIXED(2), SK_FIXED(3), SK_FIXED(5), SK_FIXED(9),
+    /* 0xd0: uint8-64, int8-64, fixext1-16, str8-32, array16/32, map16/32 */
+    SK_FIXED(2), SK_FIXED(3), SK_FIXED(5), SK_FIXED(9), SK_FIXED(3), SK_FIXED(4), SK_FIXED(6), SK_FIXED(10),
+    SK_FIXED(18), SK_PAYLOAD(1), SK_PAYLOAD(2), SK_PAYLOAD(4), SK_ARRAY(2), SK_ARRAY(4), SK_MAP(2), SK_MAP(4),
+    /* 0xe0: negative fixint */
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+    SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1), SK_FIXED(1),
+};
+
+static uint32_t skip_length(const unsigned char *p, unsigned int n) {
+    return n == 1 ? p[0] :
+           n == 2 ? decode_16bit_value(p) :
+                    decode_32bit_value(p);
+}
+
+/**
+ * @param[in] p      Encoded data
+ * @param[in] len    Number of bytes available at p
+ *
+ * Returns the size of the first object at p, including everything nested
+ * in it, without decoding it. str/bin/ext payloads are jumped over.
+ * Returns 0 if the object is truncated or malformed.
+ */
+size_t umsgpack_skip(const unsigned char *p, size_t len) {
+    uint64_t pending = 1;
+    size_t off = 0;
+
+    while (pending--) {
+        uint8_t e;
+        unsigned int n, hdr;
+        uint32_t count;
+
+        if (off == len)
+            return 0;
+        e = skip_table[p[off]];
+        n = e & 0x1f;
+
+        switch (SK_KIND(e)) {
+        case SK_KIND(SK_FIXED(1)):
+            if (len - off < n + 1)
+                return 0;
+            off += n + 1;
+            break;
+
+        case SK_KIND(SK_PAYLOAD(0)):
+        case SK_KIND(SK_EXT(0)):
+            hdr = 1 + n + (SK_KIND(e) == SK_KIND(SK_EXT(0)));
+            if (len - off < hdr)
+                return 0;
+            count = skip_length(p + off + 1, n);
+            off += hdr;
+            if (len - off < count)
+                return 0;
+            off += count;
+            break;
+
+        case SK_KIND(SK_ITEMS(0)):
+            pending += n;
+            off++;
+            break;
+
+        case SK_KIND(SK_ARRAY(0)):
+        case SK_KIND(SK_MAP(0)):
+            if (len - off < 1 + n)
+                return 0;
+            count = skip_length(p + off + 1, n);
+            pending += SK_KIND(e) == SK_KIND(SK_MAP(0)) ? (uint64_t)count * 2 : count;
+            off += 1 + n;
+            break;
+
+        default:
+            return 0;
+        }
+    }
+    return off;
+}
+
+#ifdef UMSGPACK_FUNC_HASH
+/**
+ * @param[in]     p    Encoded data
+ * @param[in]     len  Number of bytes available at p
+ * @param[in,out] h    Hash state
+ *
+ * Like umsgpack_skip(), and folds the object's bytes into h, so a
+ * received message is delimited and fingerprinted in one call.
+ */
+size_t umsgpack_skip_hash(const unsigned char *p, size_t len, struct umsgpack_hash *h) {
+    size_t n = umsgpack_skip(p, len);
+
+    if (n)
+        umsgpack_hash_update(h, p, n);
+    return n;
+}
+#endif
+
+/**
+ * @param[in] p      Encoded data
+ * @param[in] len    Length of the data
+ *
+ * Returns 1 if p holds one or more complete, well-formed objects back to
+ * back and nothing else. String contents are not checked for UTF-8.
+ */
+int umsgpack_validate(const unsigned char *p, size_t len) {
+    size_t off = 0;
+
+    if (!len)
+        return 0;
+    while (off < len) {
+        size_t n = umsgpack_skip(p + off, len - off);
+        if (!n)
+            return 0;
+        off += n;
+    }
+    return 1;
+}
+
+
+/**
+ * @param[in]  p      Encoded map
+ * @param[in]  len    Number of bytes available at p
+ * @param[in]  key    Key to look up
+ * @param[in]  keylen Length of the key
+ * @param[out] vlen   Size of the value's encoding, may be NULL
+ *
+ * Scans the entries of the map at p for a str key equal to `key' and
+ * returns a pointer to the encoded value, without decoding the entries
+ * it passes over. Returns NULL if p is not a map, the key is absent or
+ * the map is malformed before the key is reached.
+ */
+const unsigned char *umsgpack_map_find(const unsigned char *p, size_t len,
+                                       const char *key, uint32_t keylen, size_t *vlen) {
+    struct umsgpack_obj obj;
+    size_t n, off;
+    uint32_t i;
+
+    n = umsgpack_unpack_next(p, len, &obj);
+    if (!n || obj.type != UMSGPACK_TYPE_MAP)
+        return NULL;
+    off = n;
+
+    for (i = 0; i < obj.length; i++) {
+        int match = 0;
+        size_t klen = umsgpack_skip(p + off, len - off);
+
+        if (!klen)
+            return NULL;
+        /* str headers only: 0xa0-0xbf, 0xd9-0xdb */
+        if ((p[off] & 0xe0) == 0xa0 || (p[off] >= 0xd9 && p[off] <= 0xdb)) {
+            size_t hdr = (p[off] & 0xe0) == 0xa0 ? 1 : 1 + (1u << (p[off] - 0xd9));
+            match = klen - hdr == keylen && !memcmp(p + off + hdr, key, keylen);
+        }
+        off += klen;
+
+        n = umsgpack_skip(p + off, len - off);
+        if (!n)
+            return NULL;
+        if (match) {
+            if (vlen)
+                *vlen = n;
+            return p + off;
+        }
+        off += n;
+    }
+    return NULL;
+}
+
+/**
+ * @param[in]  p      Encoded map
+ * @param[in]  len    Number of bytes available at p
+ * @param[in]  path   NUL terminated keys, outermost first
+ * @param[in]  depth  Number of keys in path
+ * @param[out] vlen   Size of the value's encoding, may be NULL
+ *
+ * Follows path through nested maps with umsgpack_map_find().
+ *   e.g. path {"sensor", "degC"} finds v in {"sensor": {"degC": v}}
+ */
+const unsigned char *umsgpack_map_path(const unsigned char *p, size_t len,
+                                       const char *const *path, unsigned int depth,
+                                       size_t *vlen) {
+    size_t n = len;
+    unsigned int i;
+
+    for (i = 0; i < depth && p; i++)
+        p = umsgpack_map_find(p, n, path[i], strlen(path[i]), &n);
+    if (p && vlen)
+        *vlen = n;
+    return p;
+}
+
+
+/**
+ * @param[in]  obj    Object from umsgpack_unpack_next()
+ * @param[out] sec    Seconds since the Unix epoch
+ * @param[out] nsec   Nanoseconds
+ *
+ * Returns 1 if obj is a timestamp (ext -1, any of the three forms).
+ */
+int umsgpack_unpack_timestamp(const struct umsgpack_obj *obj, int64_t *sec, uint32_t *nsec) {
+    const unsigned char *p = obj->ptr;
+
+    if (obj->type != UMSGPACK_TYPE_EXT || obj->ext_type != EXT_TIMESTAMP)
+        return 0;
+    switch (obj->length) {
+    case 4:
+        *nsec = 0;
+        *sec = decode_32bit_value(p);
+        return 1;
+
+    case 8:
+        *nsec = decode_32bit_value(p) >> 2;
+        *sec = ((int64_t)(p[3] & 0x03) << 32) | decode_32bit_value(p + 4);
+        break;
+
+    case 12:
+        *nsec = decode_32bit_value(p);
+        *sec = (int64_t)decode_64bit_value(p + 4);
+        break;
+
+    default:
+        return 0;
+    }
+    return *nsec < 1000000000UL;
+}
+
+#ifdef UMSGPACK_FUNC_TYPED
+/**
+ * @param[in]  obj    Object from umsgpack_unpack_next()
+ * @param[out] view   Description of the array
+ *
+ * Returns 1 if obj is a typed array from umsgpack_pack_typed(). When
+ * view->direct is set the elements can be read in place through
+ * view->data; otherwise use umsgpack_typed_copy().
+ */
+int umsgpack_unpack_typed(const struct umsgpack_obj *obj, struct umsgpack_typed_view *view) {
+    unsigned int kind, size, pad;
+
+    if (obj->type != UMSGPACK_TYPE_EXT || !obj->length)
+        return 0;
+    kind = (uint8_t)(obj->ext_type - UMSGPACK_EXT_TYPED);
+    if (kind > UMSGPACK_TYPED_FLOAT32)
+        return 0;
+    size = typed_size[kind];
+    pad = obj->ptr[0];
+    if (1 + pad > obj->length || (obj->length - 1 - pad) % size)
+        return 0;
+
+    view->kind = kind;
+    view->count = (obj->length - 1 - pad) / size;
+    view->data = obj->ptr + 1 + pad;
+#ifdef UMSGPACK_LITTLE_ENDIAN
+    view->direct = (uintptr_t)view->data % size == 0;
+#else
+    view->direct = 0;
+#endif
+#if !UMSGPACK_HW_FLOAT_IEEE754COMPLIANT
+    if (kind == UMSGPACK_TYPED_FLOAT32)
+        view->direct = 0;
+#endif
+    return 1;
+}
+
+/**
+ * @param[in]  view   Array from umsgpack_unpack_typed()
+ * @param[out] dst    Native array of the view's element type
+ * @param[in]  max    Capacity of dst in elements
+ *
+ * Copies out up to max elements in host byte order and returns how many.
+ */
+uint32_t umsgpack_typed_copy(const struct umsgpack_typed_view *view, void *dst, uint32_t max) {
+    unsigned int size = typed_size[view->kind];
+    uint32_t count = view->count < max ? view->count : max;
+
+#if !UMSGPACK_HW_FLOAT_IEEE754COMPLIANT
+    if (view->kind == UMSGPACK_TYPED_FLOAT32)
+        return 0;
+#endif
+#ifdef UMSGPACK_LITTLE_ENDIAN
+    memcpy(dst, view->data, (size_t)count * size);
+#else
+    {
+        unsigned char *d = dst;
+        const unsigned char *src = view->data;
+        uint32_t i;
+        unsigned int j;
+
+        for (i = 0; i < count; i++, src += size)
+            for (j = 0; j < size; j++)
+                *d++ = src[size - 1 - j];
+    }
+#endif
+    return count;
+}
+#endif /* UMSGPACK_FUNC_TYPED */
+
+#endif /* UMSGPACK_FUNC_UNPACK */
+
+/*
+ * Schema decoder
+ */
+#ifdef UMSGPACK_FUNC_SCHEMA
+
+#ifndef UMSGPACK_FUNC_UNPACK
+#error UMSGPACK_FUNC_SCHEMA requires UMSGPACK_FUNC_UNPACK
+#endif
+
+/**
+ * @param[out] schema  Schema to set up
+ * @param[in]  fields  Field descriptors, usually built with UMSGPACK_FIELD()
+ * @param[in]  count   Number of fields
+ * @param[in]  table   Storage for the key hash table, `slots' bytes
+ * @param[in]  slots   Hash table size, at least count (2 * count works well)
+ *
+ * Returns 0 if the field names cannot be hashed into this table size.
+ */
+int umsgpack_schema_init(struct umsgpack_schema *schema, const struct umsgpack_field *fields,
+                         uint8_t count, uint8_t *table, uint8_t slots) {
+    schema->fields = fields;
+    schema->count = count;
+    schema->table = table;
+    schema->slots = slots;
+#ifdef UMSGPACK_FUNC_DICT
+    schema->dict = NULL;
+#endif
+    return phash_build(fields, sizeof(fields[0]), count, table, slots, &schema->seed);
+}
+
+static int schema_find_field(const struct umsgpack_schema *schema, const struct umsgpack_obj *key) {
+    const char *name;
+    uint32_t length;
+
+    if (key->type == UMSGPACK_TYPE_STR) {
+        name = (const char *)key->ptr;
+        length = key->length;
+#ifdef UMSGPACK_FUNC_DICT
+    } else if (key->type == UMSGPACK_TYPE_UINT && schema->dict &&
+               key->v.u < schema->dict->count) {
+        name = umsgpack_dict_name(schema->dict, (uint32_t)key->v.u);
+        length = strlen(name);
+#endif
+    } else {
+        return -1;
+    }
+    if (!schema->count)
+        return -1;
+    return phash_find(schema->fields, sizeof(schema->fields[0]), schema->table,
+                      schema->slots, schema->seed, name, length);
+}
+
+static int schema_store(const struct umsgpack_field *field, void *dst, const struct umsgpack_obj *obj) {
+    uint64_t u = obj->v.u;
+    uint64_t max = field->size >= 8 ? UINT64_MAX : ((uint64_t)1 << (field->size * 8)) - 1;
+
+    switch (field->type) {
+    case UMSGPACK_FIELD_BOOL:
+        if (obj->type != UMSGPACK_TYPE_BOOL)
+            return 0;
+        break;
+
+    case UMSGPACK_FIELD_UINT:
+        if (obj->type != UMSGPACK_TYPE_UINT || u > max)
+            return 0;
+        break;
+
+    case UMSGPACK_FIELD_INT:
+        /* two's complement range of the field: [-(max / 2) - 1, max / 2] */
+        if (obj->type == UMSGPACK_TYPE_UINT ? u > max / 2 :
+            obj->type != UMSGPACK_TYPE_INT || (uint64_t)-(obj->v.i + 1) > max / 2)
+            return 0;
+        break;
+
+    case UMSGPACK_FIELD_FLOAT: {
+        double d;
+        switch (obj->type) {
+        case UMSGPACK_TYPE_UINT: d = (double)obj->v.u; break;
+        case UMSGPACK_TYPE_INT: d = (double)obj->v.i; break;
+        case UMSGPACK_TYPE_FLOAT32: d = obj->v.f; break;
+        case UMSGPACK_TYPE_FLOAT64: d = obj->v.d; break;
+        default: return 0;
+        }
+        if (field->size == sizeof(double)) {
+            memcpy(dst, &d, sizeof(d));
+        } else if (field->size == sizeof(float)) {
+            float f = (float)d;
+            memcpy(dst, &f, sizeof(f));
+        } else {
+            return 0;
+        }
+        return 1;
+    }
+
+    case UMSGPACK_FIELD_STR:
+        if (obj->type != UMSGPACK_TYPE_STR || obj->length >= field->size)
+            return 0;
+        memcpy(dst, obj->ptr, obj->length);
+        ((char *)dst)[obj->length] = '\0';
+        return 1;
+
+    default:
+        return 0;
+    }
+
+    /* integers and bools, in the field's own width and byte order */
+    switch (field->size) {
+    case 1: { uint8_t v = (uint8_t)u; memcpy(dst, &v, 1); break; }
+    case 2: { uint16_t v = (uint16_t)u; memcpy(dst, &v, 2); break; }
+    case 4: { uint32_t v = (uint32_t)u; memcpy(dst, &v, 4); break; }
+    case 8: memcpy(dst, &u, 8); break;
+    default: return 0;
+    }
+    return 1;
+}
+
+/**
+ * @param[in]  schema Schema of the record
+ * @param[in]  p      Encoded map
+ * @param[in]  len    Number of bytes available at p
+ * @param[out] out    Struct to fill in
+ *
+ * Decodes a map straight into the members of `out' described by the
+ * schema, converting integers and floats to the member's width. Unknown
+ * keys are skipped and nil values leave the member as it was, as do
+ * fields missing from the map. A value that does not fit its member
+ * (wrong type, out of range, string too long) fails the decode; `out'
+ * may then be partially written.
+ *
+ * Returns the number of bytes consumed, or 0 on failure.
+ */
+size_t umsgpack_unpack_struct(const struct umsgpack_schema *schema, const unsigned char *p,
+                              size_t len, void *out) {
+    struct umsgpack_obj obj;
+    size_t off, n;
+    uint32_t entries, i;
+    int field;
+
+    off = umsgpack_unpack_next(p, len, &obj);
+    if (!off || obj.type != UMSGPACK_TYPE_MAP)
+        return 0;
+    entries = obj.length;
+
+    for (i = 0; i < entries; i++) {
+        n = umsgpack_unpack_next(p + off, len - off, &obj);
+        if (!n)
+            return 0;
+        if (obj.type == UMSGPACK_TYPE_ARRAY || obj.type == UMSGPACK_TYPE_MAP) {
+            n = umsgpack_skip(p + off, len - off);
+            if (!n)
+                return 0;
+            field = -1;
+        } else {
+            field = schema_find_field(schema, &obj);
+        }
+        off += n;
+
+        if (field < 0) {
+            n = umsgpack_skip(p + off, len - off);
+            if (!n)
+                return 0;
+            off += n;
+            continue;
+        }
+
+        n = umsgpack_unpack_next(p + off, len - off, &obj);
+        if (!n)
+            return 0;
+        off += n;
+        if (obj.type == UMSGPACK_TYPE_NIL)
+            continue;
+        if (!schema_store(&schema->fields[field], (char *)out + schema->fields[field].offset, &obj))
+            return 0;
+    }
+    return off;
+}
+
+#endif /* UMSGPACK_FUNC_SCHEMA */
+
+/*
+ * DOM decoder
+ */
+#ifdef UMSGPACK_FUNC_DOM
+
+#ifndef UMSGPACK_FUNC_UNPACK
+#error UMSGPACK_FUNC_DOM requires UMSGPACK_FUNC_UNPACK
+#endif
+
+/**
+ * @param[out] arena  Arena to set up
+ * @param[in]  mem    Memory for the nodes
+ * @param[in]  size   Size of mem in bytes
+ */
+void umsgpack_arena_init(struct umsgpack_arena *arena, void *mem, size_t size) {
+    size_t pad = (sizeof(struct umsgpack_node) - (uintptr_t)mem % sizeof(struct umsgpack_node)) %
+                 sizeof(struct umsgpack_node);
+
+    arena->mem = (unsigned char *)mem + (pad < size ? pad : size);
+    arena->size = pad < size ? size - pad : 0;
+    arena->used = 0;
+}
+
+static struct umsgpack_node *arena_nodes(struct umsgpack_arena *arena, uint64_t count) {
+    struct umsgpack_node *nodes;
+
+    if (count > (arena->size - arena->used) / sizeof(struct umsgpack_node))
+        return NULL;
+    nodes = (struct umsgpack_node *)(arena->mem + arena->used);
+    arena->used += (size_t)count * sizeof(struct umsgpack_node);
+    return nodes;
+}
+
+/**
+ * @param[in,out] arena    Arena the nodes are taken from
+ * @param[in]     p        Encoded data
+ * @param[in]     len      Number of bytes available at p
+ * @param[out]    consumed Size of the decoded object, may be NULL
+ *
+ * Decodes the first object at p into a tree. Returns the root node, or
+ * NULL if the input is truncated or malformed, nested deeper than
+ * UMSGPACK_DOM_MAX_DEPTH, or the arena is too small; the arena is left
+ * as it was in that case.
+ */
+const struct umsgpack_node *umsgpack_dom_parse(struct umsgpack_arena *arena, const unsigned char *p,
+                                               size_t len, size_t *consumed) {
+    struct {
+        struct umsgpack_node *next;
+        uint64_t left;
+    } stack[UMSGPACK_DOM_MAX_DEPTH + 1];
+    struct umsgpack_node *root;
+    size_t mark = arena->used, off = 0;
+    int depth = 0;
+
+    root = arena_nodes(arena, 1);
+    if (!root)
+        return NULL;
+    stack[0].next = root;
+    stack[0].left = 1;
+
+    while (depth >= 0) {
+        struct umsgpack_obj obj;
+        struct umsgpack_node *node;
+        uint64_t count;
+        size_t n;
+
+        if (!stack[depth].left) {
+            depth--;
+            continue;
+        }
+        node = stack[depth].next++;
+        stack[depth].left--;
+
+        n = umsgpack_unpack_next(p + off, len - off, &obj);
+        if (!n)
+            goto fail;
+        off += n;
+
+        node->type = obj.type;
+        node->ext_type = obj.ext_type;
+        node->length = obj.length;
+        switch (obj.type) {
+        case UMSGPACK_TYPE_STR:
+        case UMSGPACK_TYPE_BIN:
+        case UMSGPACK_TYPE_EXT:
+            node->v.ptr = obj.ptr;
+            break;
+
+        case UMSGPACK_TYPE_ARRAY:
+        case UMSGPACK_TYPE_MAP:
+            count = obj.type == UMSGPACK_TYPE_MAP ? (uint64_t)obj.length * 2 : obj.length;
+            node->v.children = NULL;
+            if (!count)
+                break;
+            if (depth == UMSGPACK_DOM_MAX_DEPTH)
+                goto fail;
+            node->v.children = stack[depth + 1].next = arena_nodes(arena, count);
+            if (!node->v.children)
+                goto fail;
+            stack[++depth].left = count;
+            break;
+
+        default:
+            node->v.u = obj.v.u;
+            break;
+        }
+    }
+
+    if (consumed)
+        *consumed = off;
+    return root;
+
+fail:
+    arena->used = mark;
+    return NULL;
+}
+
+/**
+ * @param[in] node   Array node
+ * @param[in] i      Index of the element
+ *
+ * Returns the element, or NULL if node is not an array or i is out of
+ * range.
+ */
+const struct umsgpack_node *umsgpack_node_at(const struct umsgpack_node *node, uint32_t i) {
+    if (!node || node->type != UMSGPACK_TYPE_ARRAY || i >= node->length)
+        return NULL;
+    return &node->v.children[i];
+}
+
+/**
+ * @param[in] node   Map node
+ * @param[in] key    Key to look up
+ * @param[in] length Length of the key
+ *
+ * Returns the value stored under the str key `key', or NULL.
+ */
+const struct umsgpack_node *umsgpack_node_get(const struct umsgpack_node *node,
+                                              const char *key, uint32_t length) {
+    uint32_t i;
+
+    if (!node || node->type != UMSGPACK_TYPE_MAP)
+        return NULL;
+    for (i = 0; i < node->length; i++) {
+        const struct umsgpack_node *k = &node->v.children[i * 2];
+        if (k->type == UMSGPACK_TYPE_STR && k->length == length && !memcmp(k->v.ptr, key, length))
+            return k + 1;
+    }
+    return NULL;
+}
+
+#endif /* UMSGPACK_FUNC_DOM */
@@ -31,6 +31,7 @@
 #ifndef UMSGPACK_H_
 #define UMSGPACK_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __x86_64__
@@ -74,6 +75,9 @@
  */
 
 #define UMSGPACK_HW_BIG_ENDIAN 1
+/* Microchip float: exponent in the top byte, sign at bit 23; converted
+ * to and from IEEE 754 float32 with integer ops */
+#define UMSGPACK_HW_FLOAT_MCF 1
 #endif
 
 /* NXP JN514x/516x Compiler (32bit MCU)
@@ -88,14 +92,279 @@
 #define UMSGPACK_INT_WIDTH_16 1
 #endif
 
+#ifdef UMSGPACK_GROWABLE
+/*
+ * Growable buffers: buffers from umsgpack_alloc()/umsgpack_packer_init()
+ * keep their data right after the struct and stay fixed-size;
+ * umsgpack_packer_grow_init() sets up one whose data grows geometrically
+ * through `realloc' when it fills up. realloc(ctx, ptr, 0) must free ptr.
+ */
+typedef void *(*umsgpack_realloc_fn)(void *ctx, void *ptr, size_t size);
+#endif
+
+/*
+ * Type of the packer's length and position, unsigned int by default.
+ * Tiny-RAM targets can define UMSGPACK_SIZE_TYPE as uint8_t or uint16_t
+ * to shrink the packer state and its bounds checks to register width;
+ * a buffer then holds at most UMSGPACK_SIZE_MAX bytes.
+ */
+#ifdef UMSGPACK_SIZE_TYPE
+typedef UMSGPACK_SIZE_TYPE umsgpack_size_t;
+#else
+typedef unsigned int umsgpack_size_t;
+#endif
+#define UMSGPACK_SIZE_MAX ((umsgpack_size_t)-1)
+
+#if defined(UMSGPACK_GROWABLE) || defined(UMSGPACK_FUNC_CHAIN) || defined(UMSGPACK_WRAP)
+/* `data' is a pointer so it can be moved, switched to another chunk or
+ * point at a caller's buffer */
+#define UMSGPACK_BUF_POINTER 1
+#endif
+
 struct umsgpack_packer_buf {
-    unsigned int length;
-    unsigned int pos;
+    umsgpack_size_t length;
+    umsgpack_size_t pos;
+#ifdef UMSGPACK_BUF_POINTER
+    unsigned char *data;
+#endif
+#ifdef UMSGPACK_GROWABLE
+    umsgpack_realloc_fn realloc;
+    void *ctx;
+#endif
+#ifdef UMSGPACK_FUNC_CHAIN
+    struct umsgpack_chain *chain;
+#endif
+#ifdef UMSGPACK_FUNC_HASH
+    struct umsgpack_hash *hash;
+    umsgpack_size_t hashed;      /* data before this is in the hash */
+#endif
+#ifndef UMSGPACK_BUF_POINTER
     unsigned char data[];
+#endif
 };
 
 #define umsgpack_get_length(buf) buf->pos
 
+#ifdef UMSGPACK_FUNC_DICT
+/*
+ * Shared key dictionary: keys found in the table are sent as their index
+ * (a positive fixint) instead of a string. Both ends must use the same
+ * table; `version' identifies it and is carried by the application.
+ */
+struct umsgpack_dict {
+    uint8_t version;
+    uint8_t count;
+    uint8_t seed;
+    uint8_t slots;
+    const char *const *keys;
+    uint8_t *table;
+};
+
+int umsgpack_dict_init(struct umsgpack_dict *, uint8_t, const char *const *, uint8_t, uint8_t *, uint8_t);
+int umsgpack_dict_find(const struct umsgpack_dict *, const char *, uint32_t);
+const char *umsgpack_dict_name(const struct umsgpack_dict *, uint32_t);
+int umsgpack_pack_key(struct umsgpack_packer_buf *, const struct umsgpack_dict *, const char *, uint32_t);
+#endif
+
+#ifdef UMSGPACK_FUNC_DELTA
+/*
+ * Delta records: a stream of fixed-layout records where each record is
+ * packed as a map of the fields that changed since the previous one,
+ * with every field sent again on periodic keyframes.
+ */
+enum umsgpack_delta_type {
+    UMSGPACK_DELTA_INT,      /* int32_t, value.i */
+    UMSGPACK_DELTA_FLOAT,    /* float, value.f */
+    UMSGPACK_DELTA_BOOL      /* value.i */
+};
+
+struct umsgpack_delta_field {
+    const char *key;
+    uint8_t type;            /* UMSGPACK_DELTA_* */
+};
+
+union umsgpack_delta_value {
+    int32_t i;
+    float f;
+};
+
+struct umsgpack_delta {
+    const struct umsgpack_delta_field *fields;
+    union umsgpack_delta_value *values;    /* last record sent/received */
+    uint8_t count;
+    uint8_t keyframe;
+    uint8_t since_keyframe;
+    uint8_t valid;
+#ifdef UMSGPACK_FUNC_DICT
+    const struct umsgpack_dict *dict;      /* optional, for the keys */
+#endif
+};
+
+void umsgpack_delta_init(struct umsgpack_delta *, const struct umsgpack_delta_field *,
+                         union umsgpack_delta_value *, uint8_t, uint8_t);
+int umsgpack_pack_delta(struct umsgpack_packer_buf *, struct umsgpack_delta *,
+                        const union umsgpack_delta_value *);
+#endif
+
+#ifdef UMSGPACK_FUNC_UNPACK
+enum umsgpack_type {
+    UMSGPACK_TYPE_NIL,
+    UMSGPACK_TYPE_BOOL,
+    UMSGPACK_TYPE_UINT,     /* any non-negative integer */
+    UMSGPACK_TYPE_INT,      /* negative integer */
+    UMSGPACK_TYPE_FLOAT32,
+    UMSGPACK_TYPE_FLOAT64,
+    UMSGPACK_TYPE_STR,
+    UMSGPACK_TYPE_BIN,
+    UMSGPACK_TYPE_ARRAY,
+    UMSGPACK_TYPE_MAP,
+    UMSGPACK_TYPE_EXT
+};
+
+struct umsgpack_obj {
+    uint8_t type;                /* UMSGPACK_TYPE_* */
+    int8_t ext_type;
+    uint32_t length;             /* payload bytes or number of elements */
+    const unsigned char *ptr;    /* str/bin/ext payload inside the input */
+    union {
+        uint64_t u;              /* also BOOL */
+        int64_t i;
+        float f;
+        double d;
+    } v;
+};
+
+size_t umsgpack_unpack_next(const unsigned char *, size_t, struct umsgpack_obj *);
+size_t umsgpack_skip(const unsigned char *, size_t);
+int umsgpack_validate(const unsigned char *, size_t);
+const unsigned char *umsgpack_map_find(const unsigned char *, size_t, const char *, uint32_t, size_t *);
+const unsigned char *umsgpack_map_path(const unsigned char *, size_t, const char *const *, unsigned int, size_t *);
+int umsgpack_unpack_timestamp(const struct umsgpack_obj *, int64_t *, uint32_t *);
+#ifdef UMSGPACK_FUNC_TYPED
+struct umsgpack_typed_view {
+    uint8_t kind;                /* UMSGPACK_TYPED_* */
+    uint8_t direct;              /* data is aligned and in host order */
+    uint32_t count;
+    const void *data;
+};
+
+int umsgpack_unpack_typed(const struct umsgpack_obj *, struct umsgpack_typed_view *);
+uint32_t umsgpack_typed_copy(const struct umsgpack_typed_view *, void *, uint32_t);
+#endif
+#ifdef UMSGPACK_FUNC_DELTA
+size_t umsgpack_unpack_delta(struct umsgpack_delta *, const unsigned char *, size_t);
+#endif
+#endif
+
+#ifdef UMSGPACK_FUNC_SCHEMA
+/*
+ * Schema decoder: a map is decoded straight into a C struct described by
+ * an array of field descriptors. The member's size picks the width.
+ *   e.g. static const struct umsgpack_field fields[] = {
+ *            UMSGPACK_FIELD(struct rec, id, UMSGPACK_FIELD_UINT),
+ *            UMSGPACK_FIELD_KEY(struct rec, temp, UMSGPACK_FIELD_FLOAT, "degC"),
+ *        };
+ */
+enum umsgpack_field_type {
+    UMSGPACK_FIELD_BOOL,
+    UMSGPACK_FIELD_UINT,
+    UMSGPACK_FIELD_INT,
+    UMSGPACK_FIELD_FLOAT,   /* float or double member */
+    UMSGPACK_FIELD_STR      /* char array, NUL terminated */
+};
+
+struct umsgpack_field {
+    const char *key;        /* must stay the first member */
+    uint16_t offset;
+    uint8_t type;
+    uint8_t size;
+};
+
+#define UMSGPACK_FIELD_KEY(s, member, type, key) \
+    { key, offsetof(s, member), type, sizeof(((s *)0)->member) }
+#define UMSGPACK_FIELD(s, member, type) UMSGPACK_FIELD_KEY(s, member, type, #member)
+
+struct umsgpack_schema {
+    const struct umsgpack_field *fields;
+    uint8_t count;
+    uint8_t seed;
+    uint8_t slots;
+    uint8_t *table;
+#ifdef UMSGPACK_FUNC_DICT
+    const struct umsgpack_dict *dict;      /* optional, for id keys */
+#endif
+};
+
+int umsgpack_schema_init(struct umsgpack_schema *, const struct umsgpack_field *, uint8_t, uint8_t *, uint8_t);
+size_t umsgpack_unpack_struct(const struct umsgpack_schema *, const unsigned char *, size_t, void *);
+#endif
+
+#ifdef UMSGPACK_FUNC_DOM
+/*
+ * DOM decoder: a whole document is decoded into a tree of 16-byte nodes
+ * carved from a caller-provided arena. str/bin/ext nodes point into the
+ * input, which must outlive the tree. The children of an array or map
+ * (keys and values alternating) are contiguous. Resetting the arena
+ * frees every tree built in it at once.
+ */
+#ifndef UMSGPACK_DOM_MAX_DEPTH
+#define UMSGPACK_DOM_MAX_DEPTH 32
+#endif
+
+struct umsgpack_node {
+    uint8_t type;                /* UMSGPACK_TYPE_* */
+    int8_t ext_type;
+    uint32_t length;             /* payload bytes, array elements or map pairs */
+    union {
+        uint64_t u;
+        int64_t i;
+        float f;
+        double d;
+        const unsigned char *ptr;
+        const struct umsgpack_node *children;
+    } v;
+};
+
+struct umsgpack_arena {
+    unsigned char *mem;
+    size_t size;
+    size_t used;
+};
+
+#define umsgpack_arena_reset(arena) ((arena)->used = 0)
+
+void umsgpack_arena_init(struct umsgpack_arena *, void *, size_t);
+const struct umsgpack_node *umsgpack_dom_parse(struct umsgpack_arena *, const unsigned char *, size_t, size_t *);
+const struct umsgpack_node *umsgpack_node_at(const struct umsgpack_node *, uint32_t);
+const struct umsgpack_node *umsgpack_node_get(const struct umsgpack_node *, const char *, uint32_t);
+#endif
+
+#ifdef UMSGPACK_STATS
+/*
+ * Per-format counters are indexed by UMSGPACK_STATS_INDEX(format byte):
+ * the fix* ranges share one slot each, 0xc0-0xdf get a slot per byte.
+ *   e.g. stats.formats[UMSGPACK_STATS_INDEX(0xcd)] counts uint16
+ */
+#define UMSGPACK_STATS_INDEX(b) \
+    ((b) <= 0x7f ? 0 : /* positive fixint */ \
+     (b) <= 0x8f ? 1 : /* fixmap */ \
+     (b) <= 0x9f ? 2 : /* fixarray */ \
+     (b) <= 0xbf ? 3 : /* fixstr */ \
+     (b) <= 0xdf ? 4 + ((b) - 0xc0) : \
+     36)               /* negative fixint */
+#define UMSGPACK_STATS_FORMATS 37
+
+struct umsgpack_stats {
+    uint32_t formats[UMSGPACK_STATS_FORMATS];
+    uint32_t bytes;       /* total bytes emitted */
+    uint32_t overflows;   /* calls failed for lack of buffer space */
+    uint32_t largest;     /* largest buffer position reached */
+};
+
+void umsgpack_stats_snapshot(struct umsgpack_stats *);
+void umsgpack_stats_reset(void);
+#endif
+
 int umsgpack_pack_array(struct umsgpack_packer_buf *, int);
 int umsgpack_pack_uint(struct umsgpack_packer_buf *, unsigned int);
 int umsgpack_pack_int(struct umsgpack_packer_buf *, int);
@@ -116,15 +385,287 @@ int umsgpack_pack_int64(struct umsgpack_packer_buf *, int64_t);
 #endif
 
 int umsgpack_pack_float(struct umsgpack_packer_buf *, float);
-#if 0
+int umsgpack_pack_fixed_as_float(struct umsgpack_packer_buf *, int32_t, int);
 int umsgpack_pack_double(struct umsgpack_packer_buf *, double);
+#ifdef UMSGPACK_FUNC_INT64
+int umsgpack_pack_double_narrow(struct umsgpack_packer_buf *, double);
+#endif
+#if defined(UMSGPACK_FUNC_INT32) && defined(UMSGPACK_FUNC_INT64)
+int umsgpack_pack_double_compact(struct umsgpack_packer_buf *, double);
+#endif
+#ifdef UMSGPACK_TEST_MCF
+/* the Microchip float converters, built on any host for the tests */
+uint32_t umsgpack_test_mcf_to_ieee(uint32_t);
+#ifdef UMSGPACK_FUNC_UNPACK
+uint32_t umsgpack_test_ieee_to_mcf(uint32_t);
+#endif
 #endif
 int umsgpack_pack_map(struct umsgpack_packer_buf *, uint32_t);
+int umsgpack_patch_container(struct umsgpack_packer_buf *, umsgpack_size_t, uint32_t);
 int umsgpack_pack_str(struct umsgpack_packer_buf *, const char *, uint32_t);
+unsigned char *umsgpack_reserve(struct umsgpack_packer_buf *, uint32_t);
+unsigned char *umsgpack_reserve_str(struct umsgpack_packer_buf *, uint32_t);
+unsigned char *umsgpack_reserve_bin(struct umsgpack_packer_buf *, uint32_t);
+int umsgpack_pack_bin(struct umsgpack_packer_buf *, const void *, uint32_t);
+int umsgpack_pack_ext(struct umsgpack_packer_buf *, int8_t, const void *, uint32_t);
+int umsgpack_pack_timestamp(struct umsgpack_packer_buf *, uint32_t, uint32_t);
+#ifdef UMSGPACK_FUNC_INT64
+int umsgpack_pack_timestamp64(struct umsgpack_packer_buf *, int64_t, uint32_t);
+#endif
+#ifdef UMSGPACK_FUNC_TYPED
+/*
+ * Typed arrays: a homogeneous array packed as one ext whose type code
+ * tells the element type. UMSGPACK_EXT_TYPED is the first of three
+ * consecutive application ext type codes.
+ */
+#ifndef UMSGPACK_EXT_TYPED
+#define UMSGPACK_EXT_TYPED 0x10
+#endif
+
+enum umsgpack_typed_kind {
+    UMSGPACK_TYPED_INT16,
+    UMSGPACK_TYPED_INT32,
+    UMSGPACK_TYPED_FLOAT32
+};
+
+int umsgpack_pack_typed(struct umsgpack_packer_buf *, uint8_t, const void *, uint32_t);
+#endif
 int umsgpack_pack_bool(struct umsgpack_packer_buf *, int);
 int umsgpack_pack_nil(struct umsgpack_packer_buf *);
 void umsgpack_packer_init(struct umsgpack_packer_buf *, size_t);
+#ifdef UMSGPACK_BUF_POINTER
+void umsgpack_packer_wrap(struct umsgpack_packer_buf *, void *, size_t);
+#endif
+#ifdef UMSGPACK_GROWABLE
+int umsgpack_packer_grow_init(struct umsgpack_packer_buf *, size_t, umsgpack_realloc_fn, void *);
+int umsgpack_packer_shrink(struct umsgpack_packer_buf *);
+void umsgpack_packer_release(struct umsgpack_packer_buf *);
+#define umsgpack_packer_reset(buf) ((buf)->pos = 0)
+#endif
 struct umsgpack_packer_buf *umsgpack_alloc(size_t);
 int umsgpack_free(struct umsgpack_packer_buf *);
 
+/*
+ * Allocator used by umsgpack_alloc()/umsgpack_free(); malloc/free unless
+ * UMSGPACK_NO_MALLOC is defined, in which case umsgpack_alloc() fails
+ * until one is set. Set it before the first allocation.
+ */
+struct umsgpack_allocator {
+    void *(*alloc)(void *ctx, size_t size);
+    void (*free)(void *ctx, void *ptr);
+    void *ctx;
+};
+
+void umsgpack_set_allocator(const struct umsgpack_allocator *);
+
+#ifdef UMSGPACK_FUNC_POOL
+/*
+ * Fixed-size slab pool over caller-provided memory, with O(1) acquire
+ * and release from a free list. Not thread safe.
+ *   e.g. static unsigned char mem[4 * 128];
+ *        umsgpack_pool_init(&pool, mem, sizeof(mem), 100);
+ *        umsgpack_set_allocator(&(struct umsgpack_allocator)UMSGPACK_POOL_ALLOCATOR(&pool));
+ */
+struct umsgpack_pool {
+    void *free_list;
+    size_t slab_size;
+    unsigned int count;
+    unsigned int available;
+};
+
+#define UMSGPACK_POOL_ALLOCATOR(pool) { umsgpack_pool_alloc, umsgpack_pool_free, pool }
+
+unsigned int umsgpack_pool_init(struct umsgpack_pool *, void *, size_t, size_t);
+void *umsgpack_pool_alloc(void *, size_t);
+void umsgpack_pool_free(void *, void *);
+#endif
+
+#ifdef UMSGPACK_FUNC_CHAIN
+/*
+ * Chained output: the packer writes into a list of small fixed-size
+ * chunks taken from an allocator (typically a umsgpack_pool) instead of
+ * one contiguous buffer. Format headers are never split: one that does
+ * not fit moves to the next chunk and the bytes left behind are not part
+ * of the output. str payloads are split across as many chunks as needed.
+ * umsgpack_chain_segments() lists the output for scatter transmission.
+ */
+struct umsgpack_chunk {
+    struct umsgpack_chunk *next;
+    unsigned int used;
+    unsigned char data[];
+};
+
+struct umsgpack_chain {
+    struct umsgpack_allocator allocator;
+    unsigned int chunk_size;     /* data bytes per chunk, at least 16 */
+    struct umsgpack_chunk *head;
+    struct umsgpack_chunk *tail; /* chunk the buffer is writing into */
+    struct umsgpack_chunk *spare;
+    size_t closed;               /* bytes in the chunks before tail */
+};
+
+struct umsgpack_segment {
+    const unsigned char *data;
+    unsigned int length;
+};
+
+int umsgpack_chain_init(struct umsgpack_packer_buf *, struct umsgpack_chain *,
+                        const struct umsgpack_allocator *, unsigned int);
+size_t umsgpack_chain_length(const struct umsgpack_packer_buf *);
+unsigned int umsgpack_chain_segments(const struct umsgpack_packer_buf *, struct umsgpack_segment *, unsigned int);
+void umsgpack_chain_reset(struct umsgpack_packer_buf *);
+void umsgpack_chain_free(struct umsgpack_packer_buf *);
+#endif
+
+#ifdef UMSGPACK_FUNC_HASH
+/*
+ * Content fingerprint for duplicate suppression. umsgpack_packer_hash()
+ * attaches a running hash to a packer; the bytes packed after that are
+ * folded in a block at a time, when a chunk is closed and when the
+ * digest is taken, so it matches umsgpack_hash() over the same bytes.
+ * On the receiving side umsgpack_skip_hash() finds the end of a message
+ * and hashes it in the same call.
+ *
+ * The default is a 64-bit multiply-rotate hash over 8-byte lanes.
+ * UMSGPACK_HASH_FNV selects 32-bit FNV-1a, cheaper on 8/16-bit MCUs.
+ * Both ends must be built with the same variant.
+ */
+struct umsgpack_hash {
+#ifdef UMSGPACK_HASH_FNV
+    uint32_t acc;
+#else
+    uint64_t acc;
+    uint64_t length;
+    unsigned char tail[8];
+#endif
+};
+
+void umsgpack_hash_init(struct umsgpack_hash *, uint64_t);
+void umsgpack_hash_update(struct umsgpack_hash *, const void *, size_t);
+uint64_t umsgpack_hash_digest(const struct umsgpack_hash *);
+uint64_t umsgpack_hash(const void *, size_t, uint64_t);
+void umsgpack_packer_hash(struct umsgpack_packer_buf *, struct umsgpack_hash *);
+uint64_t umsgpack_packer_digest(struct umsgpack_packer_buf *);
+#ifdef UMSGPACK_FUNC_UNPACK
+size_t umsgpack_skip_hash(const unsigned char *, size_t, struct umsgpack_hash *);
+#endif
+#endif
+
+#ifdef UMSGPACK_TRACE
+/*
+ * Per-call latency tracing.
+ *
+ * Every public umsgpack_pack_*() call made by the application is
+ * bracketed by umsgpack_trace_begin()/umsgpack_trace_end(), which read
+ * umsgpack_trace_cycles() and add the elapsed cycles to a log2 histogram
+ * kept per function. The application supplies umsgpack_trace_cycles(),
+ * e.g. returning DWT->CYCCNT on Cortex-M, a free running timer on AVR or
+ * rdtsc on x86. Calls nested from interrupt handlers are not supported.
+ *
+ * Bucket i counts calls that took [2^i, 2^(i+1)) cycles; the last bucket
+ * is open-ended.
+ */
+#ifndef UMSGPACK_TRACE_BUCKETS
+#define UMSGPACK_TRACE_BUCKETS 16
+#endif
+
+enum umsgpack_trace_func {
+    UMSGPACK_TRACE_ARRAY,
+    UMSGPACK_TRACE_UINT,
+    UMSGPACK_TRACE_INT,
+    UMSGPACK_TRACE_UINT16,
+    UMSGPACK_TRACE_INT16,
+    UMSGPACK_TRACE_UINT32,
+    UMSGPACK_TRACE_INT32,
+    UMSGPACK_TRACE_UINT64,
+    UMSGPACK_TRACE_INT64,
+    UMSGPACK_TRACE_FLOAT,
+    UMSGPACK_TRACE_FIXED_AS_FLOAT,
+    UMSGPACK_TRACE_DOUBLE,
+    UMSGPACK_TRACE_DOUBLE_NARROW,
+    UMSGPACK_TRACE_DOUBLE_COMPACT,
+    UMSGPACK_TRACE_MAP,
+    UMSGPACK_TRACE_STR,
+    UMSGPACK_TRACE_BOOL,
+    UMSGPACK_TRACE_NIL,
+    UMSGPACK_TRACE_KEY,
+    UMSGPACK_TRACE_DELTA,
+    UMSGPACK_TRACE_BIN,
+    UMSGPACK_TRACE_EXT,
+    UMSGPACK_TRACE_TYPED,
+    UMSGPACK_TRACE_TIMESTAMP,
+    UMSGPACK_TRACE_TIMESTAMP64,
+    UMSGPACK_TRACE_FUNCS
+};
+
+struct umsgpack_trace_hist {
+    uint32_t count;
+    uint32_t max;
+    uint32_t buckets[UMSGPACK_TRACE_BUCKETS];
+};
+
+uint32_t umsgpack_trace_cycles(void);
+void umsgpack_trace_begin(void);
+int umsgpack_trace_end(int, int);
+const struct umsgpack_trace_hist *umsgpack_trace_get(int);
+uint32_t umsgpack_trace_percentile(int, unsigned int);
+void umsgpack_trace_reset(void);
+
+#ifndef UMSGPACK_INTERNAL
+#define UMSGPACK_TRACE_CALL(func, call) \
+    (umsgpack_trace_begin(), umsgpack_trace_end(func, call))
+
+#define umsgpack_pack_array(buf, n) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_ARRAY, (umsgpack_pack_array)(buf, n))
+#define umsgpack_pack_uint(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_UINT, (umsgpack_pack_uint)(buf, v))
+#define umsgpack_pack_int(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_INT, (umsgpack_pack_int)(buf, v))
+#define umsgpack_pack_uint16(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_UINT16, (umsgpack_pack_uint16)(buf, v))
+#define umsgpack_pack_int16(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_INT16, (umsgpack_pack_int16)(buf, v))
+#define umsgpack_pack_uint32(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_UINT32, (umsgpack_pack_uint32)(buf, v))
+#define umsgpack_pack_int32(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_INT32, (umsgpack_pack_int32)(buf, v))
+#define umsgpack_pack_uint64(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_UINT64, (umsgpack_pack_uint64)(buf, v))
+#define umsgpack_pack_int64(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_INT64, (umsgpack_pack_int64)(buf, v))
+#define umsgpack_pack_float(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_FLOAT, (umsgpack_pack_float)(buf, v))
+#define umsgpack_pack_fixed_as_float(buf, v, n) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_FIXED_AS_FLOAT, (umsgpack_pack_fixed_as_float)(buf, v, n))
+#define umsgpack_pack_double(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_DOUBLE, (umsgpack_pack_double)(buf, v))
+#define umsgpack_pack_double_narrow(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_DOUBLE_NARROW, (umsgpack_pack_double_narrow)(buf, v))
+#define umsgpack_pack_double_compact(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_DOUBLE_COMPACT, (umsgpack_pack_double_compact)(buf, v))
+#define umsgpack_pack_map(buf, n) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_MAP, (umsgpack_pack_map)(buf, n))
+#define umsgpack_pack_str(buf, s, len) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_STR, (umsgpack_pack_str)(buf, s, len))
+#define umsgpack_pack_bool(buf, v) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_BOOL, (umsgpack_pack_bool)(buf, v))
+#define umsgpack_pack_nil(buf) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_NIL, (umsgpack_pack_nil)(buf))
+#define umsgpack_pack_key(buf, dict, key, len) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_KEY, (umsgpack_pack_key)(buf, dict, key, len))
+#define umsgpack_pack_delta(buf, delta, values) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_DELTA, (umsgpack_pack_delta)(buf, delta, values))
+#define umsgpack_pack_bin(buf, data, len) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_BIN, (umsgpack_pack_bin)(buf, data, len))
+#define umsgpack_pack_ext(buf, type, data, len) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_EXT, (umsgpack_pack_ext)(buf, type, data, len))
+#define umsgpack_pack_typed(buf, kind, values, count) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_TYPED, (umsgpack_pack_typed)(buf, kind, values, count))
+#define umsgpack_pack_timestamp(buf, sec, nsec) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_TIMESTAMP, (umsgpack_pack_timestamp)(buf, sec, nsec))
+#define umsgpack_pack_timestamp64(buf, sec, nsec) \
+    UMSGPACK_TRACE_CALL(UMSGPACK_TRACE_TIMESTAMP64, (umsgpack_pack_timestamp64)(buf, sec, nsec))
+#endif /* UMSGPACK_INTERNAL */
+#endif /* UMSGPACK_TRACE */
+
 #endif /* UMSGPACK_H_ */
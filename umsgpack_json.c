@@ -0,0 +1,1216 @@
+/*
+ * umsgpack_json.c: MessagePack <-> JSON for gateways
+ * ==================================================
+ *
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2015-2016 Rogier Lodewijks
+ *  Copyright (c) 2015-2016 ryochack
+ *  Copyright (c) 2015-2016 Takeshi HASEGAWA <hasegaw@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+/*
+ * msgpack -> JSON
+ * ---------------
+ *
+ * The input is walked once with umsgpack_unpack_next(); containers are
+ * tracked with a fixed-size stack, so nothing is allocated. Mapping:
+ *   nil, bool, int, float -> null, true/false, number
+ *   NaN, +-Inf            -> null
+ *   str                   -> string (bytes >= 0x80 are passed through)
+ *   bin                   -> base64 string
+ *   ext                   -> [type, "base64"]
+ *   bin map keys          -> base64 string
+ *   other non-string keys -> quoted scalar; ext and container keys are rejected
+ *   dictionary key ids    -> key name, when out->dict is set
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "umsgpack_json.h"
+
+#ifdef UMSGPACK_FUNC_JSON
+
+/*
+ * 0: copy as is, 'u': \u00XX, otherwise the character following '\'.
+ */
+static const char json_escape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0,   0,   '"', 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\\',0,   0,   0,
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static const char digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char base64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * @param[in] out    JSON output
+ *
+ * Hands the buffered text to out->flush() and empties the buffer.
+ */
+int umsgpack_json_flush(struct umsgpack_json_out *out) {
+    if (!out->flush)
+        return 0;
+    if (out->pos && !out->flush(out->ctx, out->buf, out->pos))
+        return 0;
+    out->pos = 0;
+    return 1;
+}
+
+/* Makes n contiguous bytes available at out->buf[out->pos]. */
+static int json_reserve(struct umsgpack_json_out *out, size_t n) {
+    if (out->size - out->pos >= n)
+        return 1;
+    return umsgpack_json_flush(out) && out->size >= n;
+}
+
+static int json_write(struct umsgpack_json_out *out, const void *data, size_t n) {
+    const char *s = data;
+
+    while (n) {
+        size_t room = out->size - out->pos;
+        if (!room) {
+            if (!umsgpack_json_flush(out) || !out->size)
+                return 0;
+            room = out->size;
+        }
+        if (room > n)
+            room = n;
+        memcpy(out->buf + out->pos, s, room);
+        out->pos += room;
+        s += room;
+        n -= room;
+    }
+    return 1;
+}
+
+static int json_putc(struct umsgpack_json_out *out, char c) {
+    if (!json_reserve(out, 1))
+        return 0;
+    out->buf[out->pos++] = c;
+    return 1;
+}
+
+/*
+ * Length of the leading run that needs no escaping. Eight bytes are
+ * tested at a time for control characters, '"' and '\'; the word test
+ * may report false positives, which the byte loop sorts out.
+ */
+#define SWAR_ONES  UINT64_C(0x0101010101010101)
+#define SWAR_HIGHS UINT64_C(0x8080808080808080)
+
+static size_t json_plain_run(const unsigned char *s, size_t n) {
+    size_t i = 0;
+
+    while (n - i >= 8) {
+        uint64_t w, q, b;
+        memcpy(&w, s + i, 8);
+        q = w ^ (SWAR_ONES * '"');
+        b = w ^ (SWAR_ONES * '\\');
+        if ((((w - SWAR_ONES * 0x20) & ~w) |
+             ((q - SWAR_ONES) & ~q) |
+             ((b - SWAR_ONES) & ~b)) & SWAR_HIGHS)
+            break;
+        i += 8;
+    }
+    while (i < n && !json_escape[s[i]])
+        i++;
+    return i;
+}
+
+static int json_string(struct umsgpack_json_out *out, const unsigned char *s, size_t n) {
+    if (!json_putc(out, '"'))
+        return 0;
+
+    while (n) {
+        size_t run = json_plain_run(s, n);
+        char esc[6];
+        char e;
+
+        if (!json_write(out, s, run))
+            return 0;
+        s += run;
+        n -= run;
+        if (!n)
+            break;
+
+        e = json_escape[*s];
+        esc[0] = '\\';
+        if (e == 'u') {
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex_digits[*s >> 4];
+            esc[5] = hex_digits[*s & 0x0f];
+            if (!json_write(out, esc, 6))
+                return 0;
+        } else {
+            esc[1] = e;
+            if (!json_write(out, esc, 2))
+                return 0;
+        }
+        s++;
+        n--;
+    }
+
+    return json_putc(out, '"');
+}
+
+static int json_uint(struct umsgpack_json_out *out, uint64_t v, int negative) {
+    char tmp[21];
+    char *p = tmp + sizeof(tmp);
+
+    while (v >= 100) {
+        const char *d = &digit_pairs[(v % 100) * 2];
+        v /= 100;
+        *--p = d[1];
+        *--p = d[0];
+    }
+    if (v < 10) {
+        *--p = '0' + (char)v;
+    } else {
+        *--p = digit_pairs[v * 2 + 1];
+        *--p = digit_pairs[v * 2];
+    }
+    if (negative)
+        *--p = '-';
+    return json_write(out, p, tmp + sizeof(tmp) - p);
+}
+
+static int json_int(struct umsgpack_json_out *out, int64_t v) {
+    if (v >= 0)
+        return json_uint(out, (uint64_t)v, 0);
+    return json_uint(out, (uint64_t)(-(v + 1)) + 1, 1);
+}
+
+/*
+ * Shortest text that reads back to the same value, laid out like "%g"
+ * but always with a '.' (printf follows LC_NUMERIC, JSON does not).
+ * Digits come from Grisu2 (Loitsch, "Printing Floating-Point Numbers
+ * Quickly and Accurately with Integers"): the result always round-trips
+ * and is the shortest such string for all but a tiny fraction of inputs.
+ */
+struct json_fp {
+    uint64_t f;
+    int e;
+};
+
+/* 10^k ~= f * 2^e with f normalised, for k = -348, -340, ..., 340. */
+static const struct {
+    uint64_t f;
+    int16_t e;
+    int16_t k;
+} json_pow10[] = {
+    { 0xFA8FD5A0081C0288ULL, -1220, -348 },
+    { 0xBAAEE17FA23EBF76ULL, -1193, -340 },
+    { 0x8B16FB203055AC76ULL, -1166, -332 },
+    { 0xCF42894A5DCE35EAULL, -1140, -324 },
+    { 0x9A6BB0AA55653B2DULL, -1113, -316 },
+    { 0xE61ACF033D1A45DFULL, -1087, -308 },
+    { 0xAB70FE17C79AC6CAULL, -1060, -300 },
+    { 0xFF77B1FCBEBCDC4FULL, -1034, -292 },
+    { 0xBE5691EF416BD60CULL, -1007, -284 },
+    { 0x8DD01FAD907FFC3CULL,  -980, -276 },
+    { 0xD3515C2831559A83ULL,  -954, -268 },
+    { 0x9D71AC8FADA6C9B5ULL,  -927, -260 },
+    { 0xEA9C227723EE8BCBULL,  -901, -252 },
+    { 0xAECC49914078536DULL,  -874, -244 },
+    { 0x823C12795DB6CE57ULL,  -847, -236 },
+    { 0xC21094364DFB5637ULL,  -821, -228 },
+    { 0x9096EA6F3848984FULL,  -794, -220 },
+    { 0xD77485CB25823AC7ULL,  -768, -212 },
+    { 0xA086CFCD97BF97F4ULL,  -741, -204 },
+    { 0xEF340A98172AACE5ULL,  -715, -196 },
+    { 0xB23867FB2A35B28EULL,  -688, -188 },
+    { 0x84C8D4DFD2C63F3BULL,  -661, -180 },
+    { 0xC5DD44271AD3CDBAULL,  -635, -172 },
+    { 0x936B9FCEBB25C996ULL,  -608, -164 },
+    { 0xDBAC6C247D62A584ULL,  -582, -156 },
+    { 0xA3AB66580D5FDAF6ULL,  -555, -148 },
+    { 0xF3E2F893DEC3F126ULL,  -529, -140 },
+    { 0xB5B5ADA8AAFF80B8ULL,  -502, -132 },
+    { 0x87625F056C7C4A8BULL,  -475, -124 },
+    { 0xC9BCFF6034C13053ULL,  -449, -116 },
+    { 0x964E858C91BA2655ULL,  -422, -108 },
+    { 0xDFF9772470297EBDULL,  -396, -100 },
+    { 0xA6DFBD9FB8E5B88FULL,  -369,  -92 },
+    { 0xF8A95FCF88747D94ULL,  -343,  -84 },
+    { 0xB94470938FA89BCFULL,  -316,  -76 },
+    { 0x8A08F0F8BF0F156BULL,  -289,  -68 },
+    { 0xCDB02555653131B6ULL,  -263,  -60 },
+    { 0x993FE2C6D07B7FACULL,  -236,  -52 },
+    { 0xE45C10C42A2B3B06ULL,  -210,  -44 },
+    { 0xAA242499697392D3ULL,  -183,  -36 },
+    { 0xFD87B5F28300CA0EULL,  -157,  -28 },
+    { 0xBCE5086492111AEBULL,  -130,  -20 },
+    { 0x8CBCCC096F5088CCULL,  -103,  -12 },
+    { 0xD1B71758E219652CULL,   -77,   -4 },
+    { 0x9C40000000000000ULL,   -50,    4 },
+    { 0xE8D4A51000000000ULL,   -24,   12 },
+    { 0xAD78EBC5AC620000ULL,     3,   20 },
+    { 0x813F3978F8940984ULL,    30,   28 },
+    { 0xC097CE7BC90715B3ULL,    56,   36 },
+    { 0x8F7E32CE7BEA5C70ULL,    83,   44 },
+    { 0xD5D238A4ABE98068ULL,   109,   52 },
+    { 0x9F4F2726179A2245ULL,   136,   60 },
+    { 0xED63A231D4C4FB27ULL,   162,   68 },
+    { 0xB0DE65388CC8ADA8ULL,   189,   76 },
+    { 0x83C7088E1AAB65DBULL,   216,   84 },
+    { 0xC45D1DF942711D9AULL,   242,   92 },
+    { 0x924D692CA61BE758ULL,   269,  100 },
+    { 0xDA01EE641A708DEAULL,   295,  108 },
+    { 0xA26DA3999AEF774AULL,   322,  116 },
+    { 0xF209787BB47D6B85ULL,   348,  124 },
+    { 0xB454E4A179DD1877ULL,   375,  132 },
+    { 0x865B86925B9BC5C2ULL,   402,  140 },
+    { 0xC83553C5C8965D3DULL,   428,  148 },
+    { 0x952AB45CFA97A0B3ULL,   455,  156 },
+    { 0xDE469FBD99A05FE3ULL,   481,  164 },
+    { 0xA59BC234DB398C25ULL,   508,  172 },
+    { 0xF6C69A72A3989F5CULL,   534,  180 },
+    { 0xB7DCBF5354E9BECEULL,   561,  188 },
+    { 0x88FCF317F22241E2ULL,   588,  196 },
+    { 0xCC20CE9BD35C78A5ULL,   614,  204 },
+    { 0x98165AF37B2153DFULL,   641,  212 },
+    { 0xE2A0B5DC971F303AULL,   667,  220 },
+    { 0xA8D9D1535CE3B396ULL,   694,  228 },
+    { 0xFB9B7CD9A4A7443CULL,   720,  236 },
+    { 0xBB764C4CA7A44410ULL,   747,  244 },
+    { 0x8BAB8EEFB6409C1AULL,   774,  252 },
+    { 0xD01FEF10A657842CULL,   800,  260 },
+    { 0x9B10A4E5E9913129ULL,   827,  268 },
+    { 0xE7109BFBA19C0C9DULL,   853,  276 },
+    { 0xAC2820D9623BF429ULL,   880,  284 },
+    { 0x80444B5E7AA7CF85ULL,   907,  292 },
+    { 0xBF21E44003ACDD2DULL,   933,  300 },
+    { 0x8E679C2F5E44FF8FULL,   960,  308 },
+    { 0xD433179D9C8CB841ULL,   986,  316 },
+    { 0x9E19DB92B4E31BA9ULL,  1013,  324 },
+    { 0xEB96BF6EBADF77D9ULL,  1039,  332 },
+    { 0xAF87023B9BF0EE6BULL,  1066,  340 },
+};
+
+static struct json_fp json_fp_mul(struct json_fp x, struct json_fp y) {
+    uint64_t a = x.f >> 32, b = x.f & 0xffffffffu;
+    uint64_t c = y.f >> 32, d = y.f & 0xffffffffu;
+    uint64_t ad = a * d, bc = b * c;
+    uint64_t mid = ((b * d) >> 32) + (ad & 0xffffffffu) + (bc & 0xffffffffu) + (1u << 31);
+    struct json_fp r;
+
+    r.f = a * c + (ad >> 32) + (bc >> 32) + (mid >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static struct json_fp json_fp_norm(struct json_fp x) {
+    while (!(x.f >> 63)) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/*
+ * Writes the digits of v = mant * 2^exp (exp_min marks a subnormal) to
+ * digits[] and returns their count; the value is digits * 10^*k.
+ */
+static int json_grisu2(char *digits, int *k, uint64_t mant, int exp, int closer) {
+    struct json_fp v, w, lo, hi, c;
+    uint64_t one, delta, dist, p2, rest, ten;
+    uint32_t p1, pow10 = 1;
+    int len = 0, n = 1, f, i;
+
+    v.f = mant;
+    v.e = exp;
+    hi.f = 2 * v.f + 1;
+    hi.e = v.e - 1;
+    hi = json_fp_norm(hi);
+    lo.f = closer ? 4 * v.f - 1 : 2 * v.f - 1;
+    lo.e = closer ? v.e - 2 : v.e - 1;
+    lo.f <<= lo.e - hi.e;
+    lo.e = hi.e;
+    w = json_fp_norm(v);
+
+    /* pick 10^-K so that the scaled upper bound has its exponent in [-60, -32] */
+    f = -60 - hi.e - 1;
+    i = (f * 78913) / (1 << 18) + (f > 0);
+    i = (348 + i + 7) / 8;
+    c.f = json_pow10[i].f;
+    c.e = json_pow10[i].e;
+    *k = -json_pow10[i].k;
+
+    w = json_fp_mul(w, c);
+    lo = json_fp_mul(lo, c);
+    hi = json_fp_mul(hi, c);
+    lo.f++;
+    hi.f--;
+
+    delta = hi.f - lo.f;
+    dist = hi.f - w.f;
+    one = (uint64_t)1 << -hi.e;
+    p1 = (uint32_t)(hi.f >> -hi.e);
+    p2 = hi.f & (one - 1);
+
+    while (p1 / pow10 >= 10) {
+        pow10 *= 10;
+        n++;
+    }
+    while (n > 0) {
+        digits[len++] = (char)('0' + p1 / pow10);
+        p1 %= pow10;
+        n--;
+        rest = ((uint64_t)p1 << -hi.e) + p2;
+        if (rest <= delta) {
+            *k += n;
+            ten = (uint64_t)pow10 << -hi.e;
+            goto round;
+        }
+        pow10 /= 10;
+    }
+    for (;;) {
+        p2 *= 10;
+        digits[len++] = (char)('0' + (p2 >> -hi.e));
+        p2 &= one - 1;
+        delta *= 10;
+        dist *= 10;
+        (*k)--;
+        if (p2 <= delta)
+            break;
+    }
+    rest = p2;
+    ten = one;
+
+round:
+    /* step the last digit down while that lands closer to w */
+    while (rest < dist && delta - rest >= ten &&
+           (rest + ten < dist || dist - rest > rest + ten - dist)) {
+        digits[len - 1]--;
+        rest += ten;
+    }
+    return len;
+}
+
+static int json_double(struct umsgpack_json_out *out, double v, int single) {
+    char tmp[32], digits[20];
+    char *p = tmp;
+    uint64_t mant;
+    int exp, closer, len, k, x, prec, i;
+
+    if (v != v || v - v != 0)
+        return json_write(out, "null", 4);
+
+    if (single) {
+        float s = (float)v;
+        uint32_t bits;
+        memcpy(&bits, &s, sizeof(bits));
+        if (bits >> 31)
+            *p++ = '-';
+        mant = bits & 0x7fffffu;
+        exp = (int)(bits >> 23 & 0xff);
+        closer = exp > 1 && !mant;
+        if (exp)
+            mant |= (uint64_t)1 << 23;
+        exp = (exp ? exp : 1) - 150;
+        prec = 6;
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        if (bits >> 63)
+            *p++ = '-';
+        mant = bits & (((uint64_t)1 << 52) - 1);
+        exp = (int)(bits >> 52 & 0x7ff);
+        closer = exp > 1 && !mant;
+        if (exp)
+            mant |= (uint64_t)1 << 52;
+        exp = (exp ? exp : 1) - 1075;
+        prec = 15;
+    }
+    if (!mant) {
+        *p++ = '0';
+        return json_write(out, tmp, p - tmp);
+    }
+    len = json_grisu2(digits, &k, mant, exp, closer);
+
+    /* same choice between fixed and exponent form as "%g" */
+    x = len + k - 1;
+    if (len > prec)
+        prec = len;
+    if (x < -4 || x >= prec) {
+        *p++ = digits[0];
+        if (len > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        *p++ = 'e';
+        *p++ = x < 0 ? '-' : '+';
+        if (x < 0)
+            x = -x;
+        if (x >= 100) {
+            *p++ = (char)('0' + x / 100);
+            x %= 100;
+        }
+        *p++ = digit_pairs[x * 2];
+        *p++ = digit_pairs[x * 2 + 1];
+    } else if (x < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (i = -1; i > x; i--)
+            *p++ = '0';
+        memcpy(p, digits, len);
+        p += len;
+    } else if (len <= x + 1) {
+        memcpy(p, digits, len);
+        p += len;
+        for (i = len; i <= x; i++)
+            *p++ = '0';
+    } else {
+        memcpy(p, digits, x + 1);
+        p += x + 1;
+        *p++ = '.';
+        memcpy(p, digits + x + 1, len - x - 1);
+        p += len - x - 1;
+    }
+    return json_write(out, tmp, p - tmp);
+}
+
+static int json_base64(struct umsgpack_json_out *out, const unsigned char *s, size_t n) {
+    char q[4];
+
+    if (!json_putc(out, '"'))
+        return 0;
+
+    for (; n >= 3; s += 3, n -= 3) {
+        q[0] = base64_digits[s[0] >> 2];
+        q[1] = base64_digits[((s[0] & 0x03) << 4) | (s[1] >> 4)];
+        q[2] = base64_digits[((s[1] & 0x0f) << 2) | (s[2] >> 6)];
+        q[3] = base64_digits[s[2] & 0x3f];
+        if (!json_write(out, q, 4))
+            return 0;
+    }
+    if (n) {
+        q[0] = base64_digits[s[0] >> 2];
+        q[1] = base64_digits[((s[0] & 0x03) << 4) | (n > 1 ? s[1] >> 4 : 0)];
+        q[2] = n > 1 ? base64_digits[(s[1] & 0x0f) << 2] : '=';
+        q[3] = '=';
+        if (!json_write(out, q, 4))
+            return 0;
+    }
+
+    return json_putc(out, '"');
+}
+
+static int json_scalar(struct umsgpack_json_out *out, const struct umsgpack_obj *obj) {
+    switch (obj->type) {
+    case UMSGPACK_TYPE_NIL:
+        return json_write(out, "null", 4);
+
+    case UMSGPACK_TYPE_BOOL:
+        return obj->v.u ? json_write(out, "true", 4) : json_write(out, "false", 5);
+
+    case UMSGPACK_TYPE_UINT:
+        return json_uint(out, obj->v.u, 0);
+
+    case UMSGPACK_TYPE_INT:
+        return json_int(out, obj->v.i);
+
+    case UMSGPACK_TYPE_FLOAT32:
+        return json_double(out, obj->v.f, 1);
+
+    case UMSGPACK_TYPE_FLOAT64:
+        return json_double(out, obj->v.d, 0);
+
+    case UMSGPACK_TYPE_STR:
+        return json_string(out, obj->ptr, obj->length);
+
+    case UMSGPACK_TYPE_BIN:
+        return json_base64(out, obj->ptr, obj->length);
+
+    case UMSGPACK_TYPE_EXT:
+        return json_putc(out, '[') &&
+               json_int(out, obj->ext_type) &&
+               json_putc(out, ',') &&
+               json_base64(out, obj->ptr, obj->length) &&
+               json_putc(out, ']');
+
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @param[in]  p      Encoded data
+ * @param[in]  len    Number of bytes available at p
+ * @param[out] out    JSON output
+ *
+ * Converts the first object at p to JSON text. The text is appended to
+ * out->buf; when a sink is used, call umsgpack_json_flush() afterwards
+ * to hand over the remainder.
+ *
+ * Returns the number of bytes of p consumed, or 0 on malformed input,
+ * nesting deeper than UMSGPACK_JSON_MAX_DEPTH or output failure.
+ */
+size_t umsgpack_to_json(const unsigned char *p, size_t len, struct umsgpack_json_out *out) {
+    struct {
+        uint64_t remain;    /* items left; a map holds two per entry */
+        uint8_t is_map;
+        uint8_t first;
+    } stack[UMSGPACK_JSON_MAX_DEPTH];
+    int depth = 0;
+    size_t off = 0;
+
+    do {
+        struct umsgpack_obj obj;
+        int is_key = 0;
+        size_t n = umsgpack_unpack_next(p + off, len - off, &obj);
+        if (!n)
+            return 0;
+        off += n;
+
+        if (depth) {
+            char sep = 0;
+            if (stack[depth - 1].is_map) {
+                is_key = !(stack[depth - 1].remain & 1);
+                if (!is_key)
+                    sep = ':';
+                else if (!stack[depth - 1].first)
+                    sep = ',';
+            } else if (!stack[depth - 1].first) {
+                sep = ',';
+            }
+            if (sep && !json_putc(out, sep))
+                return 0;
+            stack[depth - 1].first = 0;
+            stack[depth - 1].remain--;
+        }
+
+        if (obj.type == UMSGPACK_TYPE_ARRAY || obj.type == UMSGPACK_TYPE_MAP) {
+            int is_map = obj.type == UMSGPACK_TYPE_MAP;
+            if (is_key || depth == UMSGPACK_JSON_MAX_DEPTH)
+                return 0;
+            if (!json_putc(out, is_map ? '{' : '['))
+                return 0;
+            if (obj.length) {
+                stack[depth].remain = is_map ? (uint64_t)obj.length * 2 : obj.length;
+                stack[depth].is_map = is_map;
+                stack[depth].first = 1;
+                depth++;
+            } else if (!json_putc(out, is_map ? '}' : ']')) {
+                return 0;
+            }
+#ifdef UMSGPACK_FUNC_DICT
+        } else if (is_key && obj.type == UMSGPACK_TYPE_UINT && out->dict &&
+                   obj.v.u < out->dict->count) {
+            const char *name = umsgpack_dict_name(out->dict, (uint32_t)obj.v.u);
+            if (!json_string(out, (const unsigned char *)name, strlen(name)))
+                return 0;
+#endif
+        } else if (is_key && obj.type == UMSGPACK_TYPE_EXT) {
+            return 0;
+        } else if (is_key && obj.type != UMSGPACK_TYPE_STR && obj.type != UMSGPACK_TYPE_BIN) {
+            /* bin is already a quoted base64 string */
+            if (!json_putc(out, '"') || !json_scalar(out, &obj) || !json_putc(out, '"'))
+                return 0;
+        } else if (!json_scalar(out, &obj)) {
+            return 0;
+        }
+
+        while (depth && !stack[depth - 1].remain) {
+            depth--;
+            if (!json_putc(out, stack[depth].is_map ? '}' : ']'))
+                return 0;
+        }
+    } while (depth);
+
+    return off;
+}
+
+/*
+ * JSON -> msgpack
+ * ---------------
+ *
+ * A single pass tokenizer that drives the umsgpack_pack_*() functions.
+ * Containers start with a one byte fix header placeholder which is
+ * patched by umsgpack_patch_container() when the container closes; only
+ * containers with more than 15 entries move their contents to make room
+ * for the wider header.
+ * Strings are measured first and then unescaped straight into the
+ * buffer. Integers go through umsgpack_pack_int32()/int64()/uint64(),
+ * which pick the smallest width; other numbers go through
+ * umsgpack_pack_double_narrow(): float32 when that is exact, float64
+ * otherwise.
+ *
+ * The packer buffer must be contiguous.
+ */
+
+static const char *json_skip_ws(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p;
+}
+
+static int json_hex4(const char *p, const char *end, uint32_t *cp) {
+    int i;
+
+    if (end - p < 4)
+        return 0;
+    *cp = 0;
+    for (i = 0; i < 4; i++) {
+        char c = p[i];
+        *cp <<= 4;
+        if (c >= '0' && c <= '9')
+            *cp |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            *cp |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            *cp |= c - 'A' + 10;
+        else
+            return 0;
+    }
+    return 1;
+}
+
+static size_t json_utf8(uint32_t cp, unsigned char *dst) {
+    if (cp < 0x80) {
+        if (dst)
+            dst[0] = (unsigned char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        if (dst) {
+            dst[0] = 0xc0 | (cp >> 6);
+            dst[1] = 0x80 | (cp & 0x3f);
+        }
+        return 2;
+    }
+    if (cp < 0x10000) {
+        if (dst) {
+            dst[0] = 0xe0 | (cp >> 12);
+            dst[1] = 0x80 | ((cp >> 6) & 0x3f);
+            dst[2] = 0x80 | (cp & 0x3f);
+        }
+        return 3;
+    }
+    if (dst) {
+        dst[0] = 0xf0 | (cp >> 18);
+        dst[1] = 0x80 | ((cp >> 12) & 0x3f);
+        dst[2] = 0x80 | ((cp >> 6) & 0x3f);
+        dst[3] = 0x80 | (cp & 0x3f);
+    }
+    return 4;
+}
+
+/*
+ * Unescapes the string body starting after the opening quote. With dst
+ * NULL only the decoded length is computed. *stop is set to the closing
+ * quote. Returns (size_t)-1 on malformed input.
+ */
+static size_t json_unescape(const char *p, const char *end, unsigned char *dst, const char **stop) {
+    size_t n = 0;
+
+    while (p < end && *p != '"') {
+        const char *run = p;
+        uint32_t cp;
+
+        while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+            p++;
+        if (dst)
+            memcpy(dst + n, run, p - run);
+        n += p - run;
+        if (p == end || *p == '"')
+            break;
+        if (*p != '\\' || ++p == end)
+            return (size_t)-1;
+
+        switch (*p++) {
+        case '"':  cp = '"';  break;
+        case '\\': cp = '\\'; break;
+        case '/':  cp = '/';  break;
+        case 'b':  cp = '\b'; break;
+        case 'f':  cp = '\f'; break;
+        case 'n':  cp = '\n'; break;
+        case 'r':  cp = '\r'; break;
+        case 't':  cp = '\t'; break;
+        case 'u':
+            if (!json_hex4(p, end, &cp))
+                return (size_t)-1;
+            p += 4;
+            if (cp >= 0xd800 && cp <= 0xdbff) {
+                uint32_t lo;
+                if (end - p < 6 || p[0] != '\\' || p[1] != 'u' ||
+                    !json_hex4(p + 2, end, &lo) || lo < 0xdc00 || lo > 0xdfff)
+                    return (size_t)-1;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                p += 6;
+            } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+                return (size_t)-1;
+            }
+            break;
+        default:
+            return (size_t)-1;
+        }
+        n += json_utf8(cp, dst ? dst + n : NULL);
+    }
+
+    if (p == end)
+        return (size_t)-1;
+    *stop = p;
+    return n;
+}
+
+static int json_pack_string(struct umsgpack_packer_buf *buf, const char **pp, const char *end) {
+    const char *stop;
+    unsigned char *dst;
+    size_t n = json_unescape(*pp + 1, end, NULL, &stop);
+
+    if (n == (size_t)-1 || n > 0xFFFF)
+        return 0;
+    dst = umsgpack_reserve_str(buf, (uint32_t)n);
+    if (!dst)
+        return 0;
+    json_unescape(*pp + 1, end, dst, &stop);
+    *pp = stop + 1;
+    return 1;
+}
+
+/* powers of ten that a double holds exactly */
+static const double json_exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/*
+ * Big integers for the slow path. 768 significant digits decide the
+ * rounding of any decimal; scaled by the largest power of five needed
+ * they stay below 2700 bits.
+ */
+#define JSON_MAX_DIGITS 768
+#define JSON_BIG_WORDS 88
+
+struct json_big {
+    int n;
+    uint32_t w[JSON_BIG_WORDS];
+};
+
+/* b = b * m + add */
+static void json_big_mul(struct json_big *b, uint32_t m, uint32_t add) {
+    uint64_t carry = add;
+    int i;
+
+    for (i = 0; i < b->n; i++) {
+        carry += (uint64_t)b->w[i] * m;
+        b->w[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    if (carry && b->n < JSON_BIG_WORDS)
+        b->w[b->n++] = (uint32_t)carry;
+}
+
+static void json_big_pow5(struct json_big *b, int n) {
+    uint32_t m = 1;
+
+    for (; n >= 13; n -= 13)
+        json_big_mul(b, 1220703125UL, 0);
+    while (n--)
+        m *= 5;
+    json_big_mul(b, m, 0);
+}
+
+static void json_big_shl(struct json_big *b, int s) {
+    int words = s / 32, bits = s % 32, i;
+
+    if (bits) {
+        uint32_t carry = 0;
+        for (i = 0; i < b->n; i++) {
+            uint32_t w = b->w[i];
+            b->w[i] = w << bits | carry;
+            carry = w >> (32 - bits);
+        }
+        if (carry && b->n < JSON_BIG_WORDS)
+            b->w[b->n++] = carry;
+    }
+    if (words && b->n && b->n + words <= JSON_BIG_WORDS) {
+        memmove(b->w + words, b->w, b->n * sizeof(b->w[0]));
+        memset(b->w, 0, words * sizeof(b->w[0]));
+        b->n += words;
+    }
+}
+
+/* sign of d * 10^e10 - m * 2^e2 */
+static int json_big_cmp(const struct json_big *d, int e10, uint64_t m, int e2) {
+    struct json_big l = *d, r;
+    int i;
+
+    r.w[0] = (uint32_t)m;
+    r.w[1] = (uint32_t)(m >> 32);
+    r.n = r.w[1] ? 2 : r.w[0] ? 1 : 0;
+    /* 10^e10 = 5^e10 * 2^e10: powers of five on one side, of two on one side */
+    if (e10 >= 0)
+        json_big_pow5(&l, e10);
+    else
+        json_big_pow5(&r, -e10);
+    e2 -= e10;
+    if (e2 > 0)
+        json_big_shl(&r, e2);
+    else
+        json_big_shl(&l, -e2);
+
+    if (l.n != r.n)
+        return l.n < r.n ? -1 : 1;
+    for (i = l.n; i--; ) {
+        if (l.w[i] != r.w[i])
+            return l.w[i] < r.w[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Correctly rounded d * 10^e10, where sig * 10^exp10 is the same value cut
+ * to 19 digits. The cached powers of ten give an estimate m * 2^e good to
+ * a few units in the last place; exact comparisons with the halfway points
+ * to the neighbours then move it one unit at a time, ties to even.
+ * Returns the double's bit pattern, +infinity when it overflows.
+ */
+static uint64_t json_round(const struct json_big *d, int e10, uint64_t sig, int exp10) {
+    const uint64_t hidden = (uint64_t)1 << 52;
+    struct json_fp w, t;
+    uint64_t m, ten = 1;
+    int i = (exp10 + 348) / 8, e, c;
+
+    w.f = sig;
+    w.e = 0;
+    t.f = json_pow10[i].f;
+    t.e = json_pow10[i].e;
+    w = json_fp_mul(json_fp_norm(w), t);
+    for (i = exp10 - json_pow10[i].k; i; i--)
+        ten *= 10;
+    t.f = ten;
+    t.e = 0;
+    w = json_fp_norm(json_fp_mul(w, json_fp_norm(t)));
+
+    m = (w.f >> 11) + (w.f >> 10 & 1);
+    e = w.e + 11;
+    if (m >> 53) {
+        m >>= 1;
+        e++;
+    }
+    if (e < -1074) {
+        m = -1074 - e > 53 ? 0 : m >> (-1074 - e);
+        e = -1074;
+    }
+    if (e > 971) {
+        m = 2 * hidden - 1;
+        e = 971;
+    }
+
+    for (;;) {
+        c = json_big_cmp(d, e10, 2 * m + 1, e - 1);
+        if (c > 0 || (c == 0 && (m & 1))) {
+            if (++m >> 53) {
+                m >>= 1;
+                e++;
+            }
+            if (e > 971)
+                return (uint64_t)0x7ff << 52;
+            continue;
+        }
+        if (!m)
+            break;
+        /* below a power of two the lower neighbour is half as far */
+        if (m == hidden && e > -1074)
+            c = json_big_cmp(d, e10, 4 * m - 1, e - 2);
+        else
+            c = json_big_cmp(d, e10, 2 * m - 1, e - 1);
+        if (c > 0 || (c == 0 && !(m & 1)))
+            break;
+        if (m == hidden && e > -1074) {
+            m = 2 * hidden - 1;
+            e--;
+        } else {
+            m--;
+        }
+    }
+    return m >= hidden ? (uint64_t)(e + 1075) << 52 | (m - hidden) : m;
+}
+
+/*
+ * The first 19 significant digits are kept in sig, the value being
+ * sig * 10^exp10. When sig and 10^exp10 are both exact doubles a single
+ * multiply or divide rounds correctly (Clinger's fast path), which covers
+ * what sensors send. Anything else is rounded by json_round() from up to
+ * JSON_MAX_DIGITS digits. Neither path looks at the locale or calls
+ * strtod(), so the result is the same on every thread and platform.
+ */
+static int json_pack_number(struct umsgpack_packer_buf *buf, const char **pp, const char *end) {
+    const char *p = *pp, *mant, *mant_end;
+    int negative = 0, integral = 1, overflow = 0, inexact = 0;
+    int digits = 0, exp10 = 0, e_negative = 0;
+    long e = 0, k;
+    uint64_t mag = 0, sig = 0, bits;
+    double d;
+
+    if (*p == '-') {
+        negative = 1;
+        p++;
+    }
+    mant = p;
+    if (p == end || *p < '0' || *p > '9')
+        return 0;
+    if (*p == '0') {
+        p++;
+    } else {
+        while (p < end && *p >= '0' && *p <= '9') {
+            unsigned int digit = *p++ - '0';
+            if (mag > (UINT64_MAX - digit) / 10)
+                overflow = 1;
+            mag = mag * 10 + digit;
+            if (digits < 19) {
+                sig = sig * 10 + digit;
+                digits++;
+            } else {
+                exp10++;
+                inexact |= digit != 0;
+            }
+        }
+    }
+    if (p < end && *p == '.') {
+        integral = 0;
+        if (++p == end || *p < '0' || *p > '9')
+            return 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            unsigned int digit = *p++ - '0';
+            if (digits < 19) {
+                sig = sig * 10 + digit;
+                digits += sig != 0;
+                exp10--;
+            } else {
+                inexact |= digit != 0;
+            }
+        }
+    }
+    mant_end = p;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        integral = 0;
+        if (++p < end && (*p == '+' || *p == '-'))
+            e_negative = *p++ == '-';
+        if (p == end || *p < '0' || *p > '9')
+            return 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (e < 100000L)
+                e = e * 10 + (*p - '0');
+            p++;
+        }
+    }
+    *pp = p;
+
+    if (integral && !overflow) {
+        if (!negative)
+            return umsgpack_pack_uint64(buf, mag);
+        /* umsgpack_pack_int64() narrows negative values only with
+         * UMSGPACK_HW_NEGATIVE_INT64 */
+        if (mag <= (uint64_t)INT32_MAX + 1)
+            return umsgpack_pack_int32(buf, mag ? -(int32_t)(mag - 1) - 1 : 0);
+        if (mag <= (uint64_t)INT64_MAX + 1)
+            return umsgpack_pack_int64(buf, -(int64_t)(mag - 1) - 1);
+    }
+
+    /* value = sig * 10^k, which lies in [10^(k + digits - 1), 10^(k + digits)) */
+    k = exp10 + (e_negative ? -e : e);
+    if (!sig || k + digits < -324) {
+        bits = 0;
+    } else if (k + digits > 309) {
+        bits = (uint64_t)0x7ff << 52;
+    } else if (!inexact && sig <= (uint64_t)1 << 53 && k >= -22 && k <= 22) {
+        d = (double)sig;
+        d = k < 0 ? d / json_exact_pow10[-k] : d * json_exact_pow10[k];
+        return umsgpack_pack_double_narrow(buf, negative ? -d : d);
+    } else {
+        struct json_big big;
+        uint32_t chunk = 0, scale = 1;
+        int kept = 0, dropped = 0;
+
+        big.n = 0;
+        for (; mant < mant_end; mant++) {
+            if (*mant == '.' || (!kept && scale == 1 && *mant == '0'))
+                continue;
+            if (kept == JSON_MAX_DIGITS) {
+                dropped |= *mant != '0';
+                continue;
+            }
+            chunk = chunk * 10 + (*mant - '0');
+            scale *= 10;
+            kept++;
+            if (scale == 1000000000UL) {
+                json_big_mul(&big, scale, chunk);
+                chunk = 0;
+                scale = 1;
+            }
+        }
+        json_big_mul(&big, scale, chunk);
+        /* a trailing 1 stands for the digits cut off: it keeps the value
+         * strictly between the same two halfway points */
+        if (dropped) {
+            json_big_mul(&big, 10, 1);
+            kept++;
+        }
+        bits = json_round(&big, (int)k + digits - kept, sig, (int)k);
+    }
+    /* JSON has no infinity: a literal beyond DBL_MAX is an error, not inf */
+    if (bits >> 52 == 0x7ff)
+        return 0;
+    bits |= (uint64_t)negative << 63;
+    memcpy(&d, &bits, sizeof(d));
+    return umsgpack_pack_double_narrow(buf, d);
+}
+
+static int json_pack_literal(struct umsgpack_packer_buf *buf, const char **pp, const char *end) {
+    const char *p = *pp;
+    size_t left = end - p;
+
+    if (left >= 4 && !memcmp(p, "null", 4)) {
+        *pp += 4;
+        return umsgpack_pack_nil(buf);
+    }
+    if (left >= 4 && !memcmp(p, "true", 4)) {
+        *pp += 4;
+        return umsgpack_pack_bool(buf, 1);
+    }
+    if (left >= 5 && !memcmp(p, "false", 5)) {
+        *pp += 5;
+        return umsgpack_pack_bool(buf, 0);
+    }
+    return 0;
+}
+
+/**
+ * @param[in] buf    Destination buffer
+ * @param[in] json   JSON text (need not be NUL terminated)
+ * @param[in] len    Length of the text
+ *
+ * Packs one JSON value. Surrounding white space is allowed, anything else
+ * after the value is an error. Chained buffers are refused, as container
+ * headers are patched in place once their size is known. Numbers are
+ * converted without strtod() or the locale, so several threads may pack
+ * at once; one beyond the double range is an error.
+ */
+int umsgpack_pack_json(struct umsgpack_packer_buf *buf, const char *json, size_t len) {
+    struct {
+        umsgpack_size_t pos; /* placeholder header */
+        uint32_t count;
+        uint8_t is_map;
+    } stack[UMSGPACK_JSON_MAX_DEPTH];
+    int depth = 0;
+    const char *p = json, *end = json + len;
+
+#ifdef UMSGPACK_FUNC_CHAIN
+    if (buf->chain)
+        return 0;
+#endif
+    for (;;) {
+        p = json_skip_ws(p, end);
+        if (p == end)
+            return 0;
+
+        if (depth && stack[depth - 1].is_map) {
+            if (*p != '"' || !json_pack_string(buf, &p, end))
+                return 0;
+            p = json_skip_ws(p, end);
+            if (p == end || *p != ':')
+                return 0;
+            p = json_skip_ws(p + 1, end);
+            if (p == end)
+                return 0;
+        }
+
+        switch (*p) {
+        case '{':
+        case '[':
+            if (depth == UMSGPACK_JSON_MAX_DEPTH)
+                return 0;
+            stack[depth].pos = buf->pos;
+            stack[depth].count = 0;
+            stack[depth].is_map = *p == '{';
+            if (!(stack[depth].is_map ? umsgpack_pack_map(buf, 0) : umsgpack_pack_array(buf, 0)))
+                return 0;
+            p = json_skip_ws(p + 1, end);
+            if (p < end && *p == (stack[depth].is_map ? '}' : ']')) {
+                p++;
+                break;
+            }
+            depth++;
+            continue;
+
+        case '"':
+            if (!json_pack_string(buf, &p, end))
+                return 0;
+            break;
+
+        case 't':
+        case 'f':
+        case 'n':
+            if (!json_pack_literal(buf, &p, end))
+                return 0;
+            break;
+
+        default:
+            if (!json_pack_number(buf, &p, end))
+                return 0;
+            break;
+        }
+
+        /* a value is complete; close containers that end here */
+        for (;;) {
+            if (!depth)
+                return json_skip_ws(p, end) == end;
+
+            stack[depth - 1].count++;
+            p = json_skip_ws(p, end);
+            if (p == end)
+                return 0;
+            if (*p == ',') {
+                p++;
+                break;
+            }
+            if (*p != (stack[depth - 1].is_map ? '}' : ']'))
+                return 0;
+            p++;
+            depth--;
+            if (!umsgpack_patch_container(buf, stack[depth].pos, stack[depth].count))
+                return 0;
+        }
+    }
+}
+
+#endif /* UMSGPACK_FUNC_JSON */
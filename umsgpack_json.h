@@ -0,0 +1,72 @@
+/*
+ * umsgpack_json.h: MessagePack <-> JSON for gateways
+ * ==================================================
+ *
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2015-2016 Rogier Lodewijks
+ *  Copyright (c) 2015-2016 ryochack
+ *  Copyright (c) 2015-2016 Takeshi HASEGAWA <hasegaw@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef UMSGPACK_JSON_H_
+#define UMSGPACK_JSON_H_
+
+#include <stddef.h>
+#include "umsgpack.h"
+
+#ifdef UMSGPACK_FUNC_JSON
+
+#if !defined(UMSGPACK_FUNC_UNPACK) || !defined(UMSGPACK_FUNC_INT32)
+#error UMSGPACK_FUNC_JSON requires UMSGPACK_FUNC_UNPACK and UMSGPACK_FUNC_INT32
+#endif
+
+#ifndef UMSGPACK_JSON_MAX_DEPTH
+#define UMSGPACK_JSON_MAX_DEPTH 32
+#endif
+
+/*
+ * JSON output.
+ *
+ * Text is written into buf[pos..size). If flush is set, the buffer is
+ * handed to flush() whenever it fills up and reused from the start;
+ * otherwise running out of space makes the conversion fail.
+ * flush() returns non-zero on success.
+ */
+struct umsgpack_json_out {
+    char *buf;
+    size_t size;
+    size_t pos;
+    int (*flush)(void *ctx, const char *data, size_t len);
+    void *ctx;
+#ifdef UMSGPACK_FUNC_DICT
+    const struct umsgpack_dict *dict;   /* expands integer map keys */
+#endif
+};
+
+size_t umsgpack_to_json(const unsigned char *, size_t, struct umsgpack_json_out *);
+int umsgpack_json_flush(struct umsgpack_json_out *);
+
+int umsgpack_pack_json(struct umsgpack_packer_buf *, const char *, size_t);
+
+#endif /* UMSGPACK_FUNC_JSON */
+#endif /* UMSGPACK_JSON_H_ */
@@ -0,0 +1,252 @@
+/*
+ * umsgpack_log.c: MessagePack record log for gateways
+ * ===================================================
+ *
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2015-2016 Rogier Lodewijks
+ *  Copyright (c) 2015-2016 ryochack
+ *  Copyright (c) 2015-2016 Takeshi HASEGAWA <hasegaw@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdint.h>
+#include "umsgpack_log.h"
+
+#ifdef UMSGPACK_FUNC_LOG
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define UMSGPACK_LOG_MAGIC   0x4c504d55    /* "UMPL" */
+#define UMSGPACK_LOG_VERSION 1
+
+/*
+ * Opens (creating if needed) a file of at least `size' bytes and maps it.
+ */
+static void *log_map(const char *path, size_t size, int *fd) {
+    struct stat st;
+    void *p;
+
+    *fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (*fd < 0)
+        return NULL;
+    if (fstat(*fd, &st) < 0 ||
+        ((size_t)st.st_size < size && ftruncate(*fd, (off_t)size) < 0)) {
+        close(*fd);
+        return NULL;
+    }
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if (p == MAP_FAILED) {
+        close(*fd);
+        return NULL;
+    }
+    return p;
+}
+
+/**
+ * @param[out] log         Log handle
+ * @param[in]  path        Segment file
+ * @param[in]  index_path  Sidecar index file
+ * @param[in]  capacity    Segment size in bytes
+ * @param[in]  max_records Number of index entries
+ *
+ * Both files are grown to their full size up front. An existing log is
+ * reopened and appended to; its record count is cut back to the first
+ * index entry whose offset lies outside the segment or goes backwards.
+ */
+int umsgpack_log_open(struct umsgpack_log *log, const char *path, const char *index_path,
+                      size_t capacity, size_t max_records) {
+    size_t index_size = sizeof(struct umsgpack_log_header) +
+                        max_records * sizeof(struct umsgpack_log_entry);
+    void *index;
+    uint64_t i, prev;
+
+    memset(log, 0, sizeof(*log));
+    log->fd = log->index_fd = -1;
+
+    log->data = log_map(path, capacity, &log->fd);
+    if (!log->data)
+        return 0;
+    index = log_map(index_path, index_size, &log->index_fd);
+    if (!index) {
+        munmap(log->data, capacity);
+        close(log->fd);
+        return 0;
+    }
+
+    log->capacity = capacity;
+    log->max_records = max_records;
+    log->header = index;
+    log->entries = (struct umsgpack_log_entry *)(log->header + 1);
+
+    if (log->header->magic != UMSGPACK_LOG_MAGIC) {
+        log->header->magic = UMSGPACK_LOG_MAGIC;
+        log->header->version = UMSGPACK_LOG_VERSION;
+        log->header->count = 0;
+        log->header->used = 0;
+    } else if (log->header->version != UMSGPACK_LOG_VERSION ||
+               log->header->count > max_records || log->header->used > capacity) {
+        umsgpack_log_close(log);
+        return 0;
+    }
+
+    /* umsgpack_log_get() hands these offsets out unchecked */
+    prev = 0;
+    for (i = 0; i < log->header->count; i++) {
+        if (log->entries[i].offset < prev || log->entries[i].offset > log->header->used)
+            break;
+        prev = log->entries[i].offset;
+    }
+    log->header->count = i;
+    return 1;
+}
+
+/**
+ * @param[in] log       Log handle
+ * @param[in] buf       Packed record
+ * @param[in] timestamp Record time; must not go backwards
+ *
+ * The record and its index entry are written before the record count is
+ * bumped, so a log cut short by a process crash never lists a partial
+ * record. Nothing orders the two files on disk, so this does not hold
+ * across a power loss.
+ * A chained buffer is copied chunk by chunk.
+ */
+int umsgpack_log_append(struct umsgpack_log *log, const struct umsgpack_packer_buf *buf,
+                        uint64_t timestamp) {
+    struct umsgpack_log_header *hdr = log->header;
+    struct umsgpack_log_entry *e;
+    size_t size = buf->pos;
+
+#ifdef UMSGPACK_FUNC_CHAIN
+    if (buf->chain)
+        size = umsgpack_chain_length(buf);
+#endif
+    if (hdr->count == log->max_records || log->capacity - hdr->used < size)
+        return 0;
+    if (hdr->count && log->entries[hdr->count - 1].timestamp > timestamp)
+        return 0;
+
+#ifdef UMSGPACK_FUNC_CHAIN
+    if (buf->chain) {
+        const struct umsgpack_chunk *c;
+        size_t off = hdr->used;
+
+        for (c = buf->chain->head; c; c = c->next) {
+            unsigned int used = c == buf->chain->tail ? buf->pos : c->used;
+            memcpy(log->data + off, c->data, used);
+            off += used;
+        }
+    } else
+#endif
+    memcpy(log->data + hdr->used, buf->data, size);
+    e = &log->entries[hdr->count];
+    e->offset = hdr->used;
+    e->timestamp = timestamp;
+    hdr->used += size;
+    hdr->count++;
+    return 1;
+}
+
+size_t umsgpack_log_count(const struct umsgpack_log *log) {
+    return (size_t)log->header->count;
+}
+
+/**
+ * @param[in]  log       Log handle
+ * @param[in]  i         Record number
+ * @param[out] len       Record length, may be NULL
+ * @param[out] timestamp Record time, may be NULL
+ *
+ * Returns a pointer to the record inside the mapping, valid until the
+ * log is closed, or NULL if there is no such record.
+ */
+const unsigned char *umsgpack_log_get(const struct umsgpack_log *log, size_t i,
+                                      size_t *len, uint64_t *timestamp) {
+    const struct umsgpack_log_entry *e;
+    uint64_t end;
+
+    if (i >= log->header->count)
+        return NULL;
+
+    e = &log->entries[i];
+    end = i + 1 < log->header->count ? e[1].offset : log->header->used;
+    if (len)
+        *len = (size_t)(end - e->offset);
+    if (timestamp)
+        *timestamp = e->timestamp;
+    return log->data + e->offset;
+}
+
+/**
+ * @param[in] log       Log handle
+ * @param[in] timestamp Time to look for
+ *
+ * Returns the number of the first record at or after `timestamp', or
+ * umsgpack_log_count() if there is none.
+ */
+size_t umsgpack_log_find(const struct umsgpack_log *log, uint64_t timestamp) {
+    size_t lo = 0, hi = (size_t)log->header->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (log->entries[mid].timestamp < timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int umsgpack_log_sync(struct umsgpack_log *log) {
+    size_t index_size = sizeof(struct umsgpack_log_header) +
+                        log->max_records * sizeof(struct umsgpack_log_entry);
+
+    return !msync(log->data, log->capacity, MS_SYNC) &&
+           !msync(log->header, index_size, MS_SYNC);
+}
+
+void umsgpack_log_close(struct umsgpack_log *log) {
+    size_t index_size = sizeof(struct umsgpack_log_header) +
+                        log->max_records * sizeof(struct umsgpack_log_entry);
+
+    if (log->header)
+        munmap(log->header, index_size);
+    if (log->data)
+        munmap(log->data, log->capacity);
+    if (log->index_fd >= 0)
+        close(log->index_fd);
+    if (log->fd >= 0)
+        close(log->fd);
+    log->header = NULL;
+    log->entries = NULL;
+    log->data = NULL;
+    log->fd = log->index_fd = -1;
+}
+
+#endif /* UMSGPACK_FUNC_LOG */
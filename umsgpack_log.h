@@ -0,0 +1,80 @@
+/*
+ * umsgpack_log.h: MessagePack record log for gateways
+ * ===================================================
+ *
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2015-2016 Rogier Lodewijks
+ *  Copyright (c) 2015-2016 ryochack
+ *  Copyright (c) 2015-2016 Takeshi HASEGAWA <hasegaw@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef UMSGPACK_LOG_H_
+#define UMSGPACK_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "umsgpack.h"
+
+#ifdef UMSGPACK_FUNC_LOG
+
+/*
+ * Append-only log of packed records (POSIX hosts).
+ *
+ * Records are copied back to back into a preallocated, memory-mapped
+ * segment file. A sidecar index file, also mapped, holds the offset and
+ * timestamp of every record, so records can be fetched by number or
+ * located by time with a binary search, and readers get pointers into
+ * the mapping instead of copies. Both files use host byte order.
+ */
+struct umsgpack_log_entry {
+    uint64_t offset;
+    uint64_t timestamp;
+};
+
+struct umsgpack_log_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;      /* records in the log */
+    uint64_t used;       /* bytes used in the segment */
+};
+
+struct umsgpack_log {
+    int fd;
+    int index_fd;
+    unsigned char *data;
+    size_t capacity;
+    struct umsgpack_log_header *header;
+    struct umsgpack_log_entry *entries;
+    size_t max_records;
+};
+
+int umsgpack_log_open(struct umsgpack_log *, const char *, const char *, size_t, size_t);
+int umsgpack_log_append(struct umsgpack_log *, const struct umsgpack_packer_buf *, uint64_t);
+size_t umsgpack_log_count(const struct umsgpack_log *);
+const unsigned char *umsgpack_log_get(const struct umsgpack_log *, size_t, size_t *, uint64_t *);
+size_t umsgpack_log_find(const struct umsgpack_log *, uint64_t);
+int umsgpack_log_sync(struct umsgpack_log *);
+void umsgpack_log_close(struct umsgpack_log *);
+
+#endif /* UMSGPACK_FUNC_LOG */
+#endif /* UMSGPACK_LOG_H_ */
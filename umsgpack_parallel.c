@@ -0,0 +1,447 @@
+/*
+ * umsgpack_parallel.c: multi-core MessagePack processing for hosts
+ * ================================================================
+ *
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2015-2016 Rogier Lodewijks
+ *  Copyright (c) 2015-2016 ryochack
+ *  Copyright (c) 2015-2016 Takeshi HASEGAWA <hasegaw@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include "umsgpack_parallel.h"
+
+#ifdef UMSGPACK_FUNC_PARALLEL
+
+#include <pthread.h>
+#include <unistd.h>
+
+/**
+ * @param[in]  p       Concatenated records
+ * @param[in]  len     Length of the data
+ * @param[out] offsets Start offset of each record
+ * @param[in]  max     Size of offsets
+ * @param[out] end     End of the last complete record found, may be NULL
+ *
+ * Finds record boundaries with umsgpack_skip(). Stops at the end of the
+ * data, after `max' records or at the first malformed record; compare
+ * *end with len to tell them apart.
+ */
+size_t umsgpack_parallel_index(const unsigned char *p, size_t len, size_t *offsets,
+                               size_t max, size_t *end) {
+    size_t off = 0, n = 0;
+
+    while (off < len && n < max) {
+        size_t size = umsgpack_skip(p + off, len - off);
+        if (!size)
+            break;
+        offsets[n++] = off;
+        off += size;
+    }
+    if (end)
+        *end = off;
+    return n;
+}
+
+size_t umsgpack_parallel_chunks(const struct umsgpack_parallel_job *job) {
+    if (!job->chunk_records)
+        return 0;
+    return (job->records + job->chunk_records - 1) / job->chunk_records;
+}
+
+struct parallel_state {
+    const struct umsgpack_parallel_job *job;
+    pthread_mutex_t lock;
+    size_t chunks;
+    size_t next_chunk;       /* next chunk to hand out */
+    size_t next_merge;       /* next chunk to merge */
+    unsigned char *done;
+    int merging;             /* a worker is running merge() */
+    int failed;
+};
+
+static int parallel_chunk(const struct umsgpack_parallel_job *job, size_t chunk) {
+    size_t first = chunk * job->chunk_records;
+    size_t records = job->records - first < job->chunk_records ?
+                     job->records - first : job->chunk_records;
+    size_t start = job->offsets[first];
+    size_t end = first + records < job->records ? job->offsets[first + records] : job->len;
+
+    return job->work(job->ctx, chunk, job->data + start, end - start, first, records);
+}
+
+static void *parallel_worker(void *arg) {
+    struct parallel_state *st = arg;
+    const struct umsgpack_parallel_job *job = st->job;
+
+    for (;;) {
+        size_t chunk;
+        int ok;
+
+        pthread_mutex_lock(&st->lock);
+        if (st->failed || st->next_chunk == st->chunks) {
+            pthread_mutex_unlock(&st->lock);
+            break;
+        }
+        chunk = st->next_chunk++;
+        pthread_mutex_unlock(&st->lock);
+
+        ok = parallel_chunk(job, chunk);
+
+        pthread_mutex_lock(&st->lock);
+        if (!ok)
+            st->failed = 1;
+        st->done[chunk] = 1;
+        /*
+         * Whoever finds merging clear becomes the merger and calls merge()
+         * without the lock, so the others keep claiming and finishing
+         * chunks; it checks done[] again under the lock before giving the
+         * role up, so no finished chunk is left behind.
+         */
+        if (!st->merging) {
+            st->merging = 1;
+            while (!st->failed && st->next_merge < st->chunks && st->done[st->next_merge]) {
+                size_t next = st->next_merge;
+
+                pthread_mutex_unlock(&st->lock);
+                ok = !job->merge || job->merge(job->ctx, next);
+                pthread_mutex_lock(&st->lock);
+                if (!ok)
+                    st->failed = 1;
+                st->next_merge++;
+            }
+            st->merging = 0;
+        }
+        pthread_mutex_unlock(&st->lock);
+    }
+    return NULL;
+}
+
+static unsigned int parallel_threads(unsigned int n, size_t chunks) {
+    if (!n) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    return n > chunks ? (unsigned int)chunks : n;
+}
+
+/*
+ * Runs fn(arg) on n threads, the calling thread included, and waits for
+ * all of them. Fewer threads are used if they cannot be created.
+ */
+static int parallel_spawn(unsigned int n, void *(*fn)(void *), void *arg) {
+    pthread_t *threads = calloc(n, sizeof(*threads));
+    unsigned int started = 0;
+
+    if (!threads)
+        return 0;
+    while (started + 1 < n && !pthread_create(&threads[started], NULL, fn, arg))
+        started++;
+    fn(arg);
+    while (started)
+        pthread_join(threads[--started], NULL);
+    free(threads);
+    return 1;
+}
+
+/**
+ * @param[in] job    Job description
+ *
+ * Runs the job on job->threads threads, the calling thread included, and
+ * returns once every chunk has been processed and merged. Returns 0 if
+ * a callback failed or resources could not be obtained.
+ */
+int umsgpack_parallel_run(const struct umsgpack_parallel_job *job) {
+    struct parallel_state st;
+    int ok;
+
+    memset(&st, 0, sizeof(st));
+    st.job = job;
+    st.chunks = umsgpack_parallel_chunks(job);
+    if (!st.chunks)
+        return job->records == 0;
+
+    st.done = calloc(st.chunks, 1);
+    if (!st.done || pthread_mutex_init(&st.lock, NULL)) {
+        free(st.done);
+        return 0;
+    }
+
+    ok = parallel_spawn(parallel_threads(job->threads, st.chunks), parallel_worker, &st);
+
+    pthread_mutex_destroy(&st.lock);
+    free(st.done);
+    return ok && !st.failed && st.next_merge == st.chunks;
+}
+
+#ifdef UMSGPACK_BUF_POINTER
+
+struct pack_state {
+    const struct umsgpack_parallel_pack *pk;
+    pthread_mutex_t lock;
+    size_t chunks;
+    size_t next_chunk;
+    size_t *sizes;           /* per chunk: encoded size, then offset */
+    unsigned char *out;      /* NULL during the sizing pass */
+    size_t total;
+    int failed;
+};
+
+static int pack_chunk(struct pack_state *st, size_t chunk) {
+    const struct umsgpack_parallel_pack *pk = st->pk;
+    size_t i = chunk * pk->chunk_elements;
+    size_t end = pk->count - i < pk->chunk_elements ? pk->count : i + pk->chunk_elements;
+    struct umsgpack_packer_buf buf;
+    size_t size = 0;
+
+    if (!st->out) {
+        for (; i < end; i++)
+            size += pk->size(pk->ctx, i);
+        st->sizes[chunk] = size;
+        return 1;
+    }
+
+    size = (chunk + 1 < st->chunks ? st->sizes[chunk + 1] : st->total) - st->sizes[chunk];
+    umsgpack_packer_wrap(&buf, st->out + st->sizes[chunk], size);
+    for (; i < end; i++) {
+        if (!pk->encode(pk->ctx, &buf, i))
+            return 0;
+    }
+    /* a short chunk would leave a gap in the output */
+    return buf.pos == size;
+}
+
+static void *pack_worker(void *arg) {
+    struct pack_state *st = arg;
+
+    for (;;) {
+        size_t chunk;
+
+        pthread_mutex_lock(&st->lock);
+        if (st->failed || st->next_chunk == st->chunks) {
+            pthread_mutex_unlock(&st->lock);
+            break;
+        }
+        chunk = st->next_chunk++;
+        pthread_mutex_unlock(&st->lock);
+
+        if (!pack_chunk(st, chunk)) {
+            pthread_mutex_lock(&st->lock);
+            st->failed = 1;
+            pthread_mutex_unlock(&st->lock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @param[in] buf    Destination buffer, fixed-size or growable
+ * @param[in] pk     Array description
+ *
+ * Packs an array header followed by pk->count elements encoded in
+ * parallel. On failure 0 is returned and buf is left as it was.
+ */
+int umsgpack_parallel_pack_array(struct umsgpack_packer_buf *buf, const struct umsgpack_parallel_pack *pk) {
+    struct pack_state st;
+    umsgpack_size_t start = buf->pos;
+    unsigned int n;
+    size_t c, off;
+    int ok = 0;
+
+#ifdef UMSGPACK_FUNC_CHAIN
+    if (buf->chain)
+        return 0;    /* the output must be contiguous */
+#endif
+    if (pk->count > 0x7fffffff || (pk->count && !pk->chunk_elements))
+        return 0;
+    if (!pk->count)
+        return umsgpack_pack_array(buf, 0);
+
+    memset(&st, 0, sizeof(st));
+    st.pk = pk;
+    st.chunks = (pk->count + pk->chunk_elements - 1) / pk->chunk_elements;
+    st.sizes = malloc(st.chunks * sizeof(*st.sizes));
+    if (!st.sizes || pthread_mutex_init(&st.lock, NULL)) {
+        free(st.sizes);
+        return 0;
+    }
+    n = parallel_threads(pk->threads, st.chunks);
+
+    if (!parallel_spawn(n, pack_worker, &st) || st.failed)
+        goto out;
+    for (c = 0, off = 0; c < st.chunks; c++) {
+        size_t size = st.sizes[c];
+        if (size > UINT32_MAX - off)
+            goto out;
+        st.sizes[c] = off;
+        off += size;
+    }
+    st.total = off;
+
+    if (!umsgpack_pack_array(buf, (int)pk->count))
+        goto out;
+    st.out = umsgpack_reserve(buf, (uint32_t)st.total);
+    if (!st.out)
+        goto out;
+    st.next_chunk = 0;
+    ok = parallel_spawn(n, pack_worker, &st) && !st.failed;
+
+out:
+    if (!ok)
+        buf->pos = start;
+    pthread_mutex_destroy(&st.lock);
+    free(st.sizes);
+    return ok;
+}
+
+#endif /* UMSGPACK_BUF_POINTER */
+
+#ifdef UMSGPACK_FUNC_POOL
+
+struct tpool_cache {
+    struct umsgpack_tpool *owner;
+    void *head;
+    unsigned int count;
+};
+
+/* moves up to n slabs from the cache back to the shared pool */
+static void tpool_flush(struct tpool_cache *c, unsigned int n) {
+    pthread_mutex_lock(&c->owner->lock);
+    while (n-- && c->head) {
+        void *slab = c->head;
+        c->head = *(void **)slab;
+        c->count--;
+        umsgpack_pool_free(&c->owner->pool, slab);
+    }
+    pthread_mutex_unlock(&c->owner->lock);
+}
+
+static void tpool_cache_free(void *arg) {
+    struct tpool_cache *c = arg;
+
+    tpool_flush(c, c->count);
+    free(c);
+}
+
+static struct tpool_cache *tpool_cache(struct umsgpack_tpool *tp) {
+    struct tpool_cache *c = pthread_getspecific(tp->key);
+
+    if (!c) {
+        c = calloc(1, sizeof(*c));
+        if (!c)
+            return NULL;
+        c->owner = tp;
+        if (pthread_setspecific(tp->key, c)) {
+            free(c);
+            return NULL;
+        }
+    }
+    return c;
+}
+
+/**
+ * @param[out] tp        Pool to set up
+ * @param[in]  mem       Memory for the slabs
+ * @param[in]  size      Size of mem in bytes
+ * @param[in]  buf_size  Data bytes of the largest umsgpack_alloc() to serve
+ * @param[in]  batch     Slabs moved between a thread cache and the pool at once
+ *
+ * Returns the number of slabs, 0 on failure.
+ */
+unsigned int umsgpack_tpool_init(struct umsgpack_tpool *tp, void *mem, size_t size,
+                                 size_t buf_size, unsigned int batch) {
+    tp->batch = batch ? batch : 1;
+    if (!umsgpack_pool_init(&tp->pool, mem, size, buf_size))
+        return 0;
+    if (pthread_mutex_init(&tp->lock, NULL))
+        return 0;
+    if (pthread_key_create(&tp->key, tpool_cache_free)) {
+        pthread_mutex_destroy(&tp->lock);
+        return 0;
+    }
+    return tp->pool.count;
+}
+
+/**
+ * @param[in] tp     Pool
+ *
+ * Releases the pool. Other threads using it must have exited.
+ */
+void umsgpack_tpool_destroy(struct umsgpack_tpool *tp) {
+    struct tpool_cache *c = pthread_getspecific(tp->key);
+
+    if (c) {
+        pthread_setspecific(tp->key, NULL);
+        tpool_cache_free(c);
+    }
+    pthread_key_delete(tp->key);
+    pthread_mutex_destroy(&tp->lock);
+}
+
+void *umsgpack_tpool_alloc(void *ctx, size_t size) {
+    struct umsgpack_tpool *tp = ctx;
+    struct tpool_cache *c;
+    void *slab;
+    unsigned int n;
+
+    if (size > tp->pool.slab_size || !(c = tpool_cache(tp)))
+        return NULL;
+    if (!c->head) {
+        pthread_mutex_lock(&tp->lock);
+        for (n = 0; n < tp->batch && (slab = umsgpack_pool_alloc(&tp->pool, size)); n++) {
+            *(void **)slab = c->head;
+            c->head = slab;
+            c->count++;
+        }
+        pthread_mutex_unlock(&tp->lock);
+        if (!c->head)
+            return NULL;
+    }
+    slab = c->head;
+    c->head = *(void **)slab;
+    c->count--;
+    return slab;
+}
+
+void umsgpack_tpool_free(void *ctx, void *ptr) {
+    struct tpool_cache *c = tpool_cache(ctx);
+
+    if (!c) {
+        struct umsgpack_tpool *tp = ctx;
+        pthread_mutex_lock(&tp->lock);
+        umsgpack_pool_free(&tp->pool, ptr);
+        pthread_mutex_unlock(&tp->lock);
+        return;
+    }
+    *(void **)ptr = c->head;
+    c->head = ptr;
+    if (++c->count >= 2 * c->owner->batch)
+        tpool_flush(c, c->owner->batch);
+}
+
+#endif /* UMSGPACK_FUNC_POOL */
+
+#endif /* UMSGPACK_FUNC_PARALLEL */
@@ -0,0 +1,122 @@
+/*
+ * umsgpack_parallel.h: multi-core MessagePack processing for hosts
+ * ================================================================
+ *
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2015-2016 Rogier Lodewijks
+ *  Copyright (c) 2015-2016 ryochack
+ *  Copyright (c) 2015-2016 Takeshi HASEGAWA <hasegaw@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ *
+ */
+
+#ifndef UMSGPACK_PARALLEL_H_
+#define UMSGPACK_PARALLEL_H_
+
+#include <stddef.h>
+#include "umsgpack.h"
+
+#ifdef UMSGPACK_FUNC_PARALLEL
+
+#ifndef UMSGPACK_FUNC_UNPACK
+#error UMSGPACK_FUNC_PARALLEL requires UMSGPACK_FUNC_UNPACK
+#endif
+
+/*
+ * Parallel processing of a stream of concatenated records.
+ *
+ * The stream is cut into chunks of whole records using a boundary index
+ * (from umsgpack_parallel_index() or a stored index such as the record
+ * log's). Worker threads take the next unprocessed chunk until none are
+ * left, and run work() on it independently. merge(), if set, is called
+ * once per chunk in input order, never concurrently with itself, as soon
+ * as all earlier chunks are done; no lock is held while it runs, so the
+ * workers keep going.
+ *
+ * Callbacks return non-zero on success; a failure stops the run.
+ */
+struct umsgpack_parallel_job {
+    const unsigned char *data;
+    size_t len;                  /* end of the last record */
+    const size_t *offsets;       /* start of each record */
+    size_t records;
+    size_t chunk_records;        /* records per chunk */
+    unsigned int threads;        /* 0: one per online CPU */
+    int (*work)(void *ctx, size_t chunk, const unsigned char *p, size_t len,
+                size_t first_record, size_t records);
+    int (*merge)(void *ctx, size_t chunk);
+    void *ctx;
+};
+
+size_t umsgpack_parallel_index(const unsigned char *, size_t, size_t *, size_t, size_t *);
+size_t umsgpack_parallel_chunks(const struct umsgpack_parallel_job *);
+int umsgpack_parallel_run(const struct umsgpack_parallel_job *);
+
+#ifdef UMSGPACK_BUF_POINTER
+/*
+ * Parallel encoding of one large array. A first pass sums the encoded
+ * size of each chunk of elements, a prefix sum over the chunks gives
+ * each its offset in the output, and a second pass packs every chunk
+ * straight into its slice of the destination, with no copy afterwards.
+ *
+ * size() must return exactly the number of bytes encode() packs for
+ * element i; encode() gets a buffer bounded to its chunk's slice. Both
+ * run concurrently on worker threads. The UMSGPACK_STATS and
+ * UMSGPACK_TRACE counters are not thread-safe and may miss updates.
+ */
+struct umsgpack_parallel_pack {
+    size_t count;                /* array elements */
+    size_t chunk_elements;       /* elements per chunk */
+    unsigned int threads;        /* 0: one per online CPU */
+    size_t (*size)(void *ctx, size_t i);
+    int (*encode)(void *ctx, struct umsgpack_packer_buf *buf, size_t i);
+    void *ctx;
+};
+
+int umsgpack_parallel_pack_array(struct umsgpack_packer_buf *, const struct umsgpack_parallel_pack *);
+#endif
+
+#ifdef UMSGPACK_FUNC_POOL
+#include <pthread.h>
+
+/*
+ * Slab pool for multi-threaded hosts: each thread keeps a small cache
+ * of slabs and only takes the pool lock to move `batch' slabs at a time
+ * between its cache and the shared umsgpack_pool. A thread's cache goes
+ * back to the pool when the thread exits.
+ */
+struct umsgpack_tpool {
+    struct umsgpack_pool pool;
+    pthread_mutex_t lock;
+    pthread_key_t key;
+    unsigned int batch;
+};
+
+#define UMSGPACK_TPOOL_ALLOCATOR(tpool) { umsgpack_tpool_alloc, umsgpack_tpool_free, tpool }
+
+unsigned int umsgpack_tpool_init(struct umsgpack_tpool *, void *, size_t, size_t, unsigned int);
+void umsgpack_tpool_destroy(struct umsgpack_tpool *);
+void *umsgpack_tpool_alloc(void *, size_t);
+void umsgpack_tpool_free(void *, void *);
+#endif
+
+#endif /* UMSGPACK_FUNC_PARALLEL */
+#endif /* UMSGPACK_PARALLEL_H_ */